@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+#
+# See the LICENSE file for copyright and license details.
+#
+# Runs surf against each page of bench/fixtures, served by server.py, and
+# prints one JSON object per page on stdout:
+#
+#   startup    ms from starting surf to its first commit
+#   newwindow  ms from opening each further window to its first commit
+#   reload     ms to commit and finish reloading all windows (SIGHUP)
+#   rss        bytes resident in surf and its web processes once settled
+#
+# surf runs with HOME in a temporary directory, so it starts without the
+# user's cookies, cache or session, and writes ~/.surf/stats.json there on
+# SIGUSR1. statsfile and socketfile are expected at their default paths.
+# It needs an X display, xvfb-run provides one when there is none.
+#
+# usage: bench.py [-n windows] [-r reloads] [-s settle] [-t timeout] surf
+#                 [page ...]
+
+import argparse
+import json
+import os
+import shutil
+import signal
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import server
+
+pages = ["static.html", "images.html", "script.html", "links.html"]
+
+class Surf:
+	def __init__(self, path, timeout):
+		self.path = os.path.abspath(path)
+		self.timeout = timeout
+		self.home = tempfile.mkdtemp(prefix="surf-bench-")
+		self.env = dict(os.environ, HOME=self.home)
+		self.stats = os.path.join(self.home, ".surf", "stats.json")
+		self.socket = os.path.join(self.home, ".surf", "socket")
+		self.proc = None
+
+	def start(self, uri):
+		self.proc = subprocess.Popen([self.path, "-W", uri],
+				env=self.env, stderr=subprocess.DEVNULL)
+		# SIGUSR1 is handled once surf listens on its socket
+		self.wait(lambda: os.path.exists(self.socket), dump=False)
+
+	def open(self, uri):
+		subprocess.run([self.path, "-W", uri], env=self.env,
+				stderr=subprocess.DEVNULL, check=True)
+
+	def written(self):
+		try:
+			st = os.stat(self.stats)
+		except FileNotFoundError:
+			return None
+		return st.st_ino, st.st_mtime_ns
+
+	def read(self):
+		# every dump replaces the file with a new one
+		old = self.written()
+		self.proc.send_signal(signal.SIGUSR1)
+		end = time.monotonic() + self.timeout
+		while time.monotonic() < end:
+			if self.written() not in (None, old):
+				with open(self.stats) as f:
+					return json.load(f)
+			time.sleep(0.02)
+		raise TimeoutError("surf did not write " + self.stats)
+
+	def wait(self, done, dump=True):
+		end = time.monotonic() + self.timeout
+		while time.monotonic() < end:
+			if self.proc.poll() is not None:
+				raise RuntimeError("surf exited with %d"
+						% self.proc.returncode)
+			s = self.read() if dump else None
+			if done(s) if dump else done():
+				return s
+			time.sleep(0.1)
+		raise TimeoutError("surf took longer than %d s"
+				% self.timeout)
+
+	def stop(self):
+		if self.proc and self.proc.poll() is None:
+			self.proc.terminate()
+			try:
+				self.proc.wait(self.timeout)
+			except subprocess.TimeoutExpired:
+				self.proc.kill()
+				self.proc.wait()
+		shutil.rmtree(self.home, ignore_errors=True)
+
+def loads(s):
+	return sum(h["loads"] for h in s["hosts"].values())
+
+def median(v):
+	return round(statistics.median(v), 1) if v else None
+
+def run(surf, uri, args):
+	result = {"page": uri}
+
+	surf.start(uri)
+	s = surf.wait(lambda s: s["startup"] > 0 and
+			s["clients"][0]["lastfinish"] > 0)
+	result["startup"] = s["startup"]
+
+	opened = []
+	for i in range(args.windows):
+		before = [c["firstcommit"] for c in s["clients"]]
+		surf.open(uri)
+		s = surf.wait(lambda s: len(s["clients"]) > len(before) and
+				all(c["lastfinish"] > 0 for c in s["clients"]))
+		for c in s["clients"]:
+			if c["firstcommit"] in before:
+				before.remove(c["firstcommit"])
+			else:
+				opened.append(c["firstcommit"])
+	result["newwindow"] = {"median": median(opened), "samples": opened}
+
+	commit, finish = [], []
+	for i in range(args.reloads):
+		n = loads(s) + len(s["clients"])
+		surf.proc.send_signal(signal.SIGHUP)
+		s = surf.wait(lambda s: loads(s) >= n)
+		commit += [c["lastcommit"] for c in s["clients"]]
+		finish += [c["lastfinish"] for c in s["clients"]]
+	result["reload"] = {"commit": median(commit),
+			"finish": median(finish)}
+
+	time.sleep(args.settle)
+	s = surf.read()
+	result["rss"] = {"surf": s["rss"], "web": s["webprocesses"]["rss"],
+			"webprocesses": s["webprocesses"]["count"]}
+	return result
+
+def main():
+	p = argparse.ArgumentParser(description="times surf on local pages")
+	p.add_argument("-n", dest="windows", type=int, default=5,
+			help="further windows opened (5)")
+	p.add_argument("-r", dest="reloads", type=int, default=5,
+			help="reloads of all windows (5)")
+	p.add_argument("-s", dest="settle", type=float, default=5,
+			help="seconds before the RSS is read (5)")
+	p.add_argument("-t", dest="timeout", type=int, default=60,
+			help="seconds a step may take (60)")
+	p.add_argument("surf")
+	p.add_argument("pages", nargs="*", default=pages)
+	args = p.parse_args()
+
+	if not os.environ.get("DISPLAY"):
+		sys.exit("bench.py: no DISPLAY, run it under xvfb-run")
+
+	httpd = server.start()
+	failed = False
+	for page in args.pages:
+		uri = "http://127.0.0.1:%d/%s" % (httpd.server_port, page)
+		surf = Surf(args.surf, args.timeout)
+		try:
+			print(json.dumps(run(surf, uri, args)), flush=True)
+		except (RuntimeError, TimeoutError) as e:
+			print("bench.py: %s: %s" % (page, e), file=sys.stderr)
+			failed = True
+		finally:
+			surf.stop()
+	httpd.shutdown()
+	sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+	main()
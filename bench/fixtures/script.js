@@ -0,0 +1,39 @@
+/* keeps the main thread busy before the first paint and after it */
+
+function primes(n) {
+	var sieve = new Uint8Array(n), found = [], i, j;
+
+	for(i = 2; i < n; i++) {
+		if(sieve[i])
+			continue;
+		found.push(i);
+		for(j = i * i; j < n; j += i)
+			sieve[j] = 1;
+	}
+	return found;
+}
+
+function build(table, rows, cols) {
+	var p = primes(2000000), r, c, tr, td;
+
+	for(r = 0; r < rows; r++) {
+		tr = document.createElement('tr');
+		for(c = 0; c < cols; c++) {
+			td = document.createElement('td');
+			td.textContent = p[(r * cols + c) * 97 % p.length];
+			tr.appendChild(td);
+		}
+		table.appendChild(tr);
+	}
+}
+
+window.addEventListener('load', function() {
+	var cells = document.getElementsByTagName('td'), sum = 0, i;
+
+	for(i = 0; i < cells.length; i++)
+		sum += cells[i].getBoundingClientRect().width;
+	document.title += ' ' + Math.round(sum);
+	setTimeout(function() {
+		primes(1000000);
+	}, 0);
+});
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+#
+# See the LICENSE file for copyright and license details.
+#
+# Serves bench/fixtures on 127.0.0.1, the images of images.html are made up
+# on request: /img/N.bmp is a 256x256 bitmap, different for every N.
+#
+# usage: server.py [port]
+
+import http.server
+import os
+import struct
+import sys
+import threading
+
+fixtures = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+		"fixtures")
+
+def bitmap(n, size=256):
+	row = bytearray()
+	for x in range(size):
+		row += bytes(((x * 3 + n * 17) & 0xff, (x + n * 29) & 0xff,
+				(n * 53) & 0xff))
+	pixels = bytearray()
+	for y in range(size):
+		pixels += row[y * 3 % len(row):] + row[:y * 3 % len(row)]
+	header = struct.pack("<2sIHHI", b"BM", 54 + len(pixels), 0, 0, 54)
+	info = struct.pack("<IiiHHIIiiII", 40, size, size, 1, 24, 0,
+			len(pixels), 2835, 2835, 0, 0)
+	return header + info + bytes(pixels)
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+	def __init__(self, *args, **kwargs):
+		super().__init__(*args, directory=fixtures, **kwargs)
+
+	def do_GET(self):
+		path = self.path.split("?")[0]
+		if not path.startswith("/img/"):
+			return super().do_GET()
+		try:
+			n = int(path[5:].split(".")[0])
+		except ValueError:
+			return self.send_error(404)
+		body = bitmap(n)
+		self.send_response(200)
+		self.send_header("Content-Type", "image/bmp")
+		self.send_header("Content-Length", str(len(body)))
+		self.send_header("Cache-Control", "max-age=3600")
+		self.end_headers()
+		self.wfile.write(body)
+
+	def log_message(self, format, *args):
+		pass
+
+def start(port=0):
+	"""Serves in a thread, returns the server, its port is server_port."""
+	server = http.server.ThreadingHTTPServer(("127.0.0.1", port), Handler)
+	threading.Thread(target=server.serve_forever, daemon=True).start()
+	return server
+
+if __name__ == "__main__":
+	server = http.server.ThreadingHTTPServer(("127.0.0.1",
+			int(sys.argv[1]) if len(sys.argv) > 1 else 8000), Handler)
+	print("serving %s on http://127.0.0.1:%d/" % (fixtures,
+			server.server_port))
+	server.serve_forever()
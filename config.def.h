@@ -4,17 +4,96 @@ static char *useragent      = "Mozilla/5.0 (X11; U; Unix; en-US) "
 	"Safari/537.15 Surf/"VERSION;
 static char *stylefile      = "~/.surf/style.css";
 static char *scriptfile     = "~/.surf/script.js";
+static char *filterfile     = "~/.surf/filters.txt"; /* blocked hosts and
+                                                      * URL patterns */
+static char *statsfile      = "~/.surf/stats.json"; /* written on SIGUSR1 */
+static char *downloaddir    = "~/Downloads/";
+static guint maxdownloads   = 3;     /* More downloads wait in a queue */
+static char *socketfile     = "~/.surf/socket";
+static char *cachedir       = "~/.surf/cache/";
+static guint cachesize      = 0;     /* MB kept in cachedir/WebKitCache,
+                                      * least recently used files go first,
+                                      * 0: unlimited */
+/* WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER: no caching
+ * WEBKIT_CACHE_MODEL_DOCUMENT_BROWSER: local files, little memory
+ * WEBKIT_CACHE_MODEL_WEB_BROWSER: everything */
+static WebKitCacheModel cachemodel = WEBKIT_CACHE_MODEL_WEB_BROWSER;
+static char *warmupfile     = "~/.surf/warmup.txt"; /* loaded into the
+                                                     * cache on startup */
+static guint warmuptimeout  = 10;    /* Seconds the first window waits */
+static guint prefetchdelay  = 150;   /* ms a link is hovered before its
+                                      * host is resolved, 0: never */
+static guint prefetchbudget = 256;   /* Most hosts resolved in advance */
+static char *hotorigins[]   = {      /* Hosts resolved on startup */
+	/* "example.com", */
+	NULL
+};
+static guint timingsamples  = 1000;  /* Loads per host kept for the stats */
+static Bool logloads        = FALSE; /* Print the times of every load */
+static Bool tracing         = FALSE; /* Write a HAR file of every page */
+static char *tracedir       = "~/.surf/har/";
+static guint tracetop       = 5;     /* Slowest and largest resources
+                                      * printed for every trace */
+static char *sessionfile    = "~/.surf/session";
+static char *zoomfile       = "~/.surf/zoom";     /* Zoom level per host */
+static char *sitefile       = "~/.surf/sites";    /* Toggles per host */
+static char *rewritefile    = "~/.surf/rewrites"; /* URI rewrite rules */
+static guint sessionsave    = 30;    /* Seconds between saves of the open
+                                      * windows with -W, 0: never */
+
+/* Batch mode (-l), one line per URI is written to stdout */
+static char *batchdir       = ".";   /* Output directory */
+static char *batchoutputs   = "p";   /* p: PNG snapshot; d: PDF; t: text */
+static guint batchjobs      = 1;     /* Views loading in parallel */
+static guint batchsettle    = 500;   /* ms to wait after a load finished */
+static guint batchtimeout   = 30;    /* Seconds a load may take, 0: no
+                                      * limit */
 
 static Bool kioskmode       = FALSE; /* Ignore shortcuts */
 static Bool showindicators  = TRUE;  /* Show indicators in window title */
+static int startmode        = ModeInsert; /* ModeNormal: keys without
+                                           * modifier are bindings */
+static guint findmax        = 1000;  /* Most matches found and counted */
+static guint scrollstep     = 40;    /* Pixels scrolled by a step */
+static Bool smoothscroll    = TRUE;  /* Animate scrolling over frames */
 static Bool zoomto96dpi     = TRUE;  /* Zoom pages to always emulate 96dpi */
 static Bool runinfullscreen = FALSE; /* Run in fullscreen mode by default */
+static Bool singleinstance  = FALSE; /* Open new windows in a running surf */
+static Bool restoresession  = FALSE; /* Reopen the windows of sessionfile */
+static guint poolsize       = 0;     /* Prepared hidden windows, each one
+                                      * keeps a web process running */
+
+/* WEBKIT_PROCESS_MODEL_SHARED_SECONDARY_PROCESS: one web process for all
+ * WEBKIT_PROCESS_MODEL_MULTIPLE_SECONDARY_PROCESSES: one per window */
+static WebKitProcessModel processmodel =
+	WEBKIT_PROCESS_MODEL_MULTIPLE_SECONDARY_PROCESSES;
+static guint webprocesses   = 0;     /* Most web processes, 0: unlimited */
+static Bool groupbyorigin   = TRUE;  /* Windows of a host share a process */
+static guint discardidle    = 0;     /* Seconds an unfocused window stays
+                                      * idle before its page is discarded,
+                                      * 0: never */
+static Bool discardunmapped = FALSE; /* Discard pages of unmapped windows */
+static guint memoryinterval = 0;     /* Seconds between checks for low
+                                      * memory, 0: never */
+static guint memoryavail    = 256;   /* MB available below which memory
+                                      * is low */
+static gdouble memorypressure = 10.0; /* % of time stalled on memory
+                                       * above which memory is low */
+static guint memorycooldown = 60;    /* Seconds at least between web
+                                      * processes restarted for low
+                                      * memory */
 
 static guint defaultfontsize = 16;   /* Default font size */
 static gfloat zoomlevel = 1.0;       /* Default zoom level */
 
 /* Soup default features */
 static char *cookiefile     = "~/.surf/cookies.txt";
+static char *cookiedb       = "~/.surf/cookies.db";
+/* WEBKIT_COOKIE_PERSISTENT_STORAGE_TEXT: cookiefile
+ * WEBKIT_COOKIE_PERSISTENT_STORAGE_SQLITE: cookiedb, cookiefile is imported
+ *                                          once into a new cookiedb */
+static WebKitCookiePersistentStorage cookiestorage =
+	WEBKIT_COOKIE_PERSISTENT_STORAGE_TEXT;
 static char *cookiepolicies = "Aa@"; /* A: accept all; a: accept nothing,
                                         @: accept no third party */
 static Bool strictssl      = FALSE; /* Refuse untrusted SSL connections */
@@ -36,13 +115,11 @@ static Bool allowgeolocation = TRUE;
 	} \
 }
 
-/* DOWNLOAD(URI, referer) */
-#define DOWNLOAD(d, r) { \
+/* DOWNLOADDONE(file), run when a download finished successfully */
+#define DOWNLOADDONE(f) { \
 	.v = (char *[]){ "/bin/sh", "-c", \
-		"st -e /bin/sh -c \"curl -L -J -O --user-agent '$1'" \
-		" --referer '$2' -b $3 -c $3 '$0';" \
-		" sleep 5;\"", \
-		d, useragent, r, cookiefile, NULL \
+		"command -v notify-send >/dev/null && notify-send surf \"$0\"", \
+		f, NULL \
 	} \
 }
 
@@ -51,10 +128,11 @@ static Bool allowgeolocation = TRUE;
 /* hotkeys */
 /*
  * If you use anything else but MODKEY and GDK_SHIFT_MASK, don't forget to
- * edit the CLEANMASK() macro.
+ * edit the CLEANMASK() macro. Without a mode, a key is bound in all modes.
+ * Digits typed with MODKEY, or alone in ModeNormal, repeat the next binding.
  */
 static Key keys[] = {
-    /* modifier	            keyval      function    arg             Focus */
+    /* modifier	            keyval      function    arg             mode */
     { MODKEY|GDK_SHIFT_MASK,GDK_KEY_r,      reload,     { .b = TRUE } },
     { MODKEY,               GDK_KEY_r,      reload,     { .b = FALSE } },
     { MODKEY|GDK_SHIFT_MASK,GDK_KEY_p,      print,      { 0 } },
@@ -81,6 +159,7 @@ static Key keys[] = {
     { 0,                    GDK_KEY_F11,    fullscreen, { 0 } },
     { 0,                    GDK_KEY_Escape, stop,       { 0 } },
     { MODKEY|GDK_SHIFT_MASK,GDK_KEY_o,      inspector,  { 0 } },
+    { MODKEY|GDK_SHIFT_MASK,GDK_KEY_t,      writetrace, { 0 } },
 
     { MODKEY,               GDK_KEY_g,      spawn,      SETPROP("_SURF_URI", "_SURF_GO") },
     { MODKEY,               GDK_KEY_f,      spawn,      SETPROP("_SURF_FIND", "_SURF_FIND") },
@@ -91,11 +170,21 @@ static Key keys[] = {
 
     { MODKEY|GDK_SHIFT_MASK,GDK_KEY_c,      toggle,     { .v = "enable-caret-browsing" } },
     { MODKEY|GDK_SHIFT_MASK,GDK_KEY_i,      toggle,     { .v = "auto-load-images" } },
-    { MODKEY|GDK_SHIFT_MASK,GDK_KEY_s,      toggle,     { .v = "enable-javascript" } },
+    { MODKEY|GDK_SHIFT_MASK,GDK_KEY_s,      toggle,     { .v = "enable-javascript-markup" } },
     { MODKEY|GDK_SHIFT_MASK,GDK_KEY_v,      toggle,     { .v = "enable-plugins" } },
     { MODKEY|GDK_SHIFT_MASK,GDK_KEY_a,      togglecookiepolicy, { 0 } },
     { MODKEY|GDK_SHIFT_MASK,GDK_KEY_m,      togglestyle, { 0 } },
     { MODKEY|GDK_SHIFT_MASK,GDK_KEY_b,      togglescrollbars, { 0 } },
     { MODKEY|GDK_SHIFT_MASK,GDK_KEY_g,      togglegeolocation, { 0 } },
+
+    { MODKEY,               GDK_KEY_bracketleft, setmode, { .i = ModeNormal } },
+    { 0,                    GDK_KEY_i,      setmode,    { .i = ModeInsert }, ModeNormal },
+    { 0,                    GDK_KEY_j,      scroll_v,   { .i = +1 },    ModeNormal },
+    { 0,                    GDK_KEY_k,      scroll_v,   { .i = -1 },    ModeNormal },
+    { 0,                    GDK_KEY_h,      scroll_h,   { .i = -1 },    ModeNormal },
+    { 0,                    GDK_KEY_l,      scroll_h,   { .i = +1 },    ModeNormal },
+    { 0,                    GDK_KEY_n,      find,       { .b = TRUE },  ModeNormal },
+    { GDK_SHIFT_MASK,       GDK_KEY_n,      find,       { .b = FALSE }, ModeNormal },
+    { 0,                    GDK_KEY_slash,  spawn,      SETPROP("_SURF_FIND", "_SURF_FIND"), ModeNormal },
 };
 
@@ -6,21 +6,27 @@ VERSION = 0.6
 # paths
 PREFIX = /usr/local
 MANPREFIX = ${PREFIX}/share/man
+LIBPREFIX = ${PREFIX}/lib
+LIBDIR = ${LIBPREFIX}/surf
 
 X11INC = /usr/X11R6/include
 X11LIB = /usr/X11R6/lib
 
-GTKINC = `pkg-config --cflags gtk+-3.0 webkit2gtk-4.0`
-GTKLIB = `pkg-config --libs gtk+-3.0 webkit2gtk-4.0`
+GTKINC = `pkg-config --cflags gtk+-3.0 gio-unix-2.0 webkit2gtk-4.0`
+GTKLIB = `pkg-config --libs gtk+-3.0 gio-unix-2.0 webkit2gtk-4.0`
+
+WEBEXTINC = `pkg-config --cflags webkit2gtk-web-extension-4.0`
+WEBEXTLIBS = `pkg-config --libs webkit2gtk-web-extension-4.0`
 
 # includes and libs
 INCS = -I. -I/usr/include -I${X11INC} ${GTKINC}
 LIBS = -L/usr/lib -lc -L${X11LIB} -lX11 ${GTKLIB} -lgthread-2.0
 
 # flags
-CPPFLAGS = -DVERSION=\"${VERSION}\" -D_BSD_SOURCE
+CPPFLAGS = -DVERSION=\"${VERSION}\" -DWEBEXTDIR=\"${LIBDIR}\" -D_BSD_SOURCE
 CFLAGS = -std=c99 -pedantic -Wall -Os ${INCS} ${CPPFLAGS}
 LDFLAGS = -g ${LIBS}
+WEBEXTCFLAGS = -std=c99 -pedantic -Wall -Os -fPIC ${WEBEXTINC}
 
 # Solaris
 #CFLAGS = -fast ${INCS} -DVERSION=\"${VERSION}\"
@@ -12,7 +12,7 @@ then
 fi
 
 runtabbed() {
-	tabbed -dn tabbed-surf -r 2 surf -e '' "$uri" >"$xidfile" \
+	tabbed -dn tabbed-surf -r 3 surf -W -e '' "$uri" >"$xidfile" \
 		2>/dev/null &
 }
 
@@ -26,7 +26,7 @@ else
 	then
 		runtabbed
 	else
-		surf -e "$xid" "$uri" >/dev/null 2>&1 &
+		surf -W -e "$xid" "$uri" >/dev/null 2>&1 &
 	fi
 fi
 
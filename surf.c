@@ -24,6 +24,8 @@
 #include <sys/file.h>
 #include <libgen.h>
 #include <stdarg.h>
+#include <glib-unix.h>
+#include <gio/gunixsocketaddress.h>
 
 #include "arg.h"
 
@@ -33,6 +35,8 @@ char *argv0;
 #define CLEANMASK(mask)         (mask & (MODKEY|GDK_SHIFT_MASK))
 
 enum { AtomFind, AtomGo, AtomUri, AtomLast };
+enum { DirtyToggles = 1 << 0, DirtyPage = 1 << 1 };
+enum { ModeAny, ModeNormal, ModeInsert };
 
 typedef union Arg Arg;
 union Arg {
@@ -44,18 +48,89 @@ union Arg {
 typedef struct Client {
 	GtkWidget *win, *scroll, *vbox, *pane;
 	WebKitWebView *view;
+	pid_t webpid;
 	WebKitWebInspector *inspector;
-	const char *title, *needle, *linkhover;
+	const char *needle;
+	char *title, *linkhover, *wintitle;
+	char togglestat[8], pagestat[3];
+	guint dirty, titleidle;
+	char *prop[AtomLast];
+	guint propdirty, propidle, propskip[AtomLast];
 	gint progress;
+	guint resources, cachehits, cachemisses;
+	guint64 bytes;
 	struct Client *next;
+	gint64 opened, firstcommit;
+	char *batchuri;
+	guint batchseq, batchleft, settle, batchtimer;
+	gboolean batchloading;
+	gint64 batchstart, batchload;
+	gint64 active;
+	guint discardtimer, discardreport;
+	guint64 discardrss;
+	GCancellable *discarding;
+	WebKitWebViewSessionState *session;
+	WebKitSettings *settings;
+	cairo_surface_t *thumb;
+	GtkWidget *placeholder;
+	char *discarduri;
+	gdouble discardzoom, defaultzoom;
+	glong scrollx, scrolly;
+	gboolean restorescroll;
+	GVariant *sessionentry;
+	guint prefetchtimer;
+	GPtrArray *trace;
+	gint64 tracestarted;
+	gint64 loadstart, loadcommit, loadpaint, loadfinish;
+	gint64 lastcommit, lastfinish;
+	char *loaduri, *posturi;
+	gboolean loadprefetched;
+	char *findtext;
+	guint findmatch, findcount;
+	gboolean findmoved;
+	int mode;
+	guint count;
+	gint scrolldx, scrolldy;
+	guint scrolltick;
+	gint64 scrollframe;
 	gboolean zoomed, fullscreen, isinspecting, sslfailed, userstyle;
+	gboolean geolocation, rewritten, norewrite, sessiontoggles;
 } Client;
 
+typedef struct {
+	char *path;
+	time_t used;
+	off_t size;
+} CacheFile;
+
+/* one resource of a traced page, shared with the WebKitWebResource */
+typedef struct {
+	char *uri, *method, *mime, *error;
+	guint status;
+	guint64 size;
+	gint64 started, start, sent, response, end;
+} TraceEntry;
+
+/* a line of rewritefile */
+typedef struct {
+	GRegex *re;
+	char *replacement;
+	guint hits;
+	gboolean inset;
+} Rewrite;
+
+/* the last timingsamples loads of a host, in ms */
+typedef struct {
+	GArray *commit, *paint, *finish;
+	guint loads;
+} HostTimes;
+
 typedef struct {
 	guint mod;
 	guint keyval;
 	void (*func)(Client *c, const Arg *arg);
 	const Arg arg;
+	int mode;
 } Key;
 
 static Display *dpy;
@@ -65,21 +140,90 @@ static Window embed = 0;
 static gboolean showxid = FALSE;
 static char winid[64];
 static gboolean usingproxy = 0;
-static char togglestat[8];
-static char pagestat[3];
+static guint titleupdates = 0, titlepeak = 0;
+static char *batchfile = NULL;
+static FILE *batchin;
+static guint batchseq = 0;
+static GList *downloads = NULL, *dlqueue = NULL;
+static guint dlcompleted = 0;
 static int policysel = 0;
-
-static void addaccelgroup(Client *c);
+static char *filterstore;
+static WebKitUserContentFilter *contentfilter = NULL;
+static WebKitUserScript *userscript = NULL;
+static WebKitUserStyleSheet *usersheet = NULL;
+static GFileMonitor *scriptmon, *stylemon;
+static GSocketService *instance = NULL;
+static WebKitWebContext *context;
+static gint64 started, stamped, startupcommit = 0;
+static gboolean tracestartup = FALSE, quitting = FALSE;
+static GMainLoop *warmuploop = NULL;
+static guint lateidle = 0;
+static gboolean latedone = FALSE;
+static WebKitUserScript *perfscript = NULL;
+static guint cachehits = 0, cachemisses = 0;
+static guint64 cachetrimmed = 0;
+static GHashTable *prefetched;
+static GHashTable *hosttimes;
+static GHashTable *keymap;
+static GHashTable *zooms, *zoomchanged;
+static guint zoomsave = 0;
+static GHashTable *sites, *sitechanged;
+static guint sitesave = 0;
+static GArray *rewrites;
+static GRegex *rewriteset = NULL;
+static guint prefetches = 0, prefetchhits = 0;
+static gint64 commitprefetched = 0, commitother = 0;
+static guint commitsprefetched = 0, commitsother = 0;
+static GList *pool = NULL;
+static guint poolfill = 0, poolhits = 0, poolmisses = 0;
+static guint discards = 0;
+static guint scrollframes = 0, scrolljank = 0;
+static guint64 discardedbytes = 0;
+static char *cgroupdir = NULL;
+static guint memorylevel = 0, memorysteps[3], memoryreportid = 0;
+static guint64 memoryrss = 0, memoryreclaimed = 0;
+static gint64 memoryrestarted = 0;
+static const char *memoryactions[] = {
+	"cleared caches", "discarded hidden windows",
+	"restarted the largest web process of unfocused windows"
+};
+static gboolean sessiondirty = FALSE, sessionwriting = FALSE;
+static gboolean focusonmap = TRUE;
+
+static gboolean batch(void);
+static void batchdone(Client *c);
+static gboolean batchexpired(gpointer d);
+static char *batchline(void);
+static void batchload(Client *c, char *uri);
+static char *batchpath(Client *c, const char *ext);
+static void batchpng(GObject *o, GAsyncResult *res, gpointer d);
+static void batchprinted(WebKitPrintOperation *p, Client *c);
+static gboolean batchsnapshot(gpointer d);
+static void batchtext(GObject *o, GAsyncResult *res, gpointer d);
 static void beforerequest(WebKitWebView *w,
 		WebKitWebResource *r, WebKitURIRequest *req,
-		gpointer d);
+		Client *c);
+static void buildkeymap(void);
+static void builddir(const char *path);
 static char *buildpath(const char *path);
+static char *resolvepath(const char *path);
 static void cleanup(void);
+static WebKitCacheModel cachemodelarg(const char *s);
+static guint64 cachetrim(void);
+static gint cachetrimcmp(gconstpointer a, gconstpointer b);
+static void cachetrimthread(GTask *t, gpointer o, gpointer d,
+		GCancellable *cancel);
+static gboolean cachetrimtimer(gpointer d);
+static void cachetrimmeddone(GObject *o, GAsyncResult *res, gpointer d);
 static void clipboard(Client *c, const Arg *arg);
+static void compilefilters(WebKitUserContentFilterStore *store);
+static void connectview(Client *c);
 static WebKitCookieAcceptPolicy cookiepolicy_get(void);
 static char cookiepolicy_set(const WebKitCookieAcceptPolicy p);
 static WebKitWebView *createwindow(WebKitWebView *v, WebKitNavigationAction *a,
 		Client *c);
+static gboolean decidedestination(WebKitDownload *d, gchar *name,
+		gpointer unused);
 static gboolean decidepolicy (WebKitWebView *v, WebKitPolicyDecision *d,
 		WebKitPolicyDecisionType t, Client *c);
 static gboolean permisssionrequested(WebKitWebView *v, WebKitPermissionRequest *r,
@@ -87,45 +231,124 @@ static gboolean permisssionrequested(WebKitWebView *v, WebKitPermissionRequest *
 static void destroyclient(Client *c);
 static void destroywin(GtkWidget* w, Client *c);
 static void die(const char *errstr, ...);
+static void discard(Client *c);
+static gboolean discardcheck(gpointer d);
+static gboolean discardreport(gpointer d);
+static void discardscroll(GObject *o, GAsyncResult *res, gpointer d);
+static void discardsnapshot(GObject *o, GAsyncResult *res, gpointer d);
+static void discardview(Client *c);
+static void downloadfailed(WebKitDownload *d, GError *err, gpointer unused);
+static void downloadfinished(WebKitDownload *d, gpointer unused);
+static void downloadprogress(WebKitDownload *d, GParamSpec *pspec,
+		gpointer unused);
+static void downloadstarted(WebKitWebContext *ctx, WebKitDownload *d,
+		gpointer unused);
+static gboolean drawthumb(GtkWidget *w, cairo_t *cr, Client *c);
+static gboolean dumpstats(gpointer d);
 static void eval(Client *c, const Arg *arg);
+static gboolean fillpool(gpointer d);
+static void filterloaded(GObject *o, GAsyncResult *res, gpointer d);
+static void filtersaved(GObject *o, GAsyncResult *res, gpointer d);
 static void find(Client *c, const Arg *arg);
+static void findcounted(WebKitFindController *f, guint n, Client *c);
+static void findfailed(WebKitFindController *f, Client *c);
+static gboolean flushatoms(gpointer d);
+static void freehosttimes(gpointer d);
 static void fullscreen(Client *c, const Arg *arg);
 static const char *getatom(Client *c, int a);
+static Client *getclient(WebKitWebView *v);
+static char *gethost(const char *uri);
 static void gettogglestat(Client *c);
 static void getpagestat(Client *c);
 static char *geturi(Client *c);
-static gboolean initdownload(WebKitURIRequest *r, Client *c);
 
+static void importcookies(WebKitCookieManager *cm);
+static gboolean instanceconnect(GSocketService *s, GSocketConnection *conn,
+		GObject *src, gpointer d);
+static void instanceread(GObject *o, GAsyncResult *res, gpointer d);
 static void inspector(Client *c, const Arg *arg);
 static gboolean inspector_show(WebKitWebInspector *i, Client *c);
 static gboolean inspector_close(WebKitWebInspector *i, Client *c);
-
-static gboolean keypress(GtkAccelGroup *group,
-		GObject *obj, guint key, GdkModifierType mods,
-		Client *c);
+static gboolean inuse(Client *c);
+
+static void jsonstr(GString *s, const char *str);
+static void jsontime(GString *s, gint64 t);
+static void jsontimes(GString *s, const char *name, GArray *a);
+static gint cmpdouble(gconstpointer a, gconstpointer b);
+static char *jsresultstr(WebKitJavascriptResult *r);
+static gboolean keypress(GtkWidget *w, GdkEventKey *ev, Client *c);
 static void mousetargetchange(WebKitWebView *v, WebKitHitTestResult *r,
 		guint modifiers, Client *c);
 static void loadstatuschange(WebKitWebView *view, WebKitLoadEvent e,
 		Client *c);
+static gboolean lateinit(gpointer d);
+static void listeninstance(void);
+static void loadfilters(void);
+static void loadrewrites(void);
+static guint loadsession(void);
+static void loadstate(Client *c, WebKitWebViewSessionState *s,
+		const char *uri);
+static void loadsample(Client *c);
+static void loadtimes(Client *c);
 static void loaduri(Client *c, const Arg *arg);
+static void loadusercontent(void);
+static void loadzooms(void);
+static void loadsites(void);
 static void navigate(Client *c, const Arg *arg);
-static Client *newclient(void);
+static Client *newclient(Client *rc);
+static void newview(Client *c, WebKitWebView *rv, WebKitSettings *settings);
 static void newwindow(Client *c, const Arg *arg, gboolean noembed);
+static gboolean numberedrefs(const char *pattern);
+static void openwindow(const char *uri, Window xid);
 static void pasteuri(GtkClipboard *clipboard, const char *text, gpointer d);
+static gboolean prefetch(const char *host);
+static gboolean prefetchhover(gpointer d);
 static gboolean contextmenu(WebKitWebView *v, WebKitContextMenu *menu,
 		GdkEvent *e, WebKitHitTestResult *r, Client *c);
 static void menuactivate(GtkAction *gaction, Client *c);
+static gboolean memorycheck(gpointer d);
+static gboolean memoryreport(gpointer d);
+static GFileMonitor *monitorfile(const char *path);
+static Client *prepareclient(Client *rc);
 static void print(Client *c, const Arg *arg);
 static GdkFilterReturn processx(GdkXEvent *xevent, GdkEvent *event,
 		gpointer d);
 static void progresschange(WebKitWebView *view, GParamSpec *pspec, Client *c);
+static gboolean quit(gpointer d);
+static void readatom(Client *c, int a);
 static void reload(Client *c, const Arg *arg);
+static gboolean reloadall(gpointer d);
+static void resourcefinished(WebKitWebResource *r, WebKitWebView *v);
+static void restore(Client *c);
+static char *rewrite(const char *uri);
+static gboolean rewriteview(Client *c, const char *uri);
+static void scriptmessage(WebKitUserContentManager *m,
+		WebKitJavascriptResult *r, Client *c);
 static void scroll_h(Client *c, const Arg *arg);
 static void scroll_v(Client *c, const Arg *arg);
-static void scroll(GtkAdjustment *a, const Arg *arg);
+static gint scrolldelta(gint size, const Arg *arg);
+static gboolean scrollframe(GtkWidget *w, GdkFrameClock *fc, gpointer d);
+static void scrollby(Client *c, gint dx, gint dy);
+static gboolean savesession(gpointer d);
+static gboolean savesites(gpointer d);
+static gboolean savezooms(gpointer d);
+static gboolean sendinstance(const char *uri, gboolean send);
+static gboolean instanceopts(char **argv);
+static void sessionchanged(Client *c);
+static GVariant *sessionentry(Client *c);
+static void sessionsaved(GObject *o, GAsyncResult *res, gpointer d);
 static void setatom(Client *c, int a, const char *v);
+static void setmode(Client *c, const Arg *arg);
+static void setsite(Client *c, char toggle);
+static void settoggles(Client *c, const char *t);
 static void setup(void);
+static gboolean settitle(gpointer d);
+static void setusercontent(Client *c);
+static void sample(GArray *a, gint64 from, gint64 to);
 static void sigchld(int unused);
+static void sitesettings(Client *c);
+static void sitezoom(Client *c);
+static void stamp(const char *phase);
 static void spawn(Client *c, const Arg *arg);
 static void stop(Client *c, const Arg *arg);
 static void titlechange(WebKitWebView *view, GParamSpec *pspec, Client *c);
@@ -134,63 +357,321 @@ static void togglecookiepolicy(Client *c, const Arg *arg);
 static void togglegeolocation(Client *c, const Arg *arg);
 static void togglescrollbars(Client *c, const Arg *arg);
 static void togglestyle(Client *c, const Arg *arg);
+static void tracedata(WebKitWebResource *r, guint64 len, gpointer d);
+static void tracefailed(WebKitWebResource *r, GError *err, gpointer d);
+static void tracefree(gpointer d);
+static guint translatekey(GtkWidget *w, GdkEventKey *ev, gint group,
+		guint *mods);
+static void traceresource(Client *c, WebKitWebResource *r,
+		WebKitURIRequest *req);
+static void traceresponse(WebKitWebResource *r, GParamSpec *pspec,
+		gpointer d);
+static void tracesent(WebKitWebResource *r, WebKitURIRequest *req,
+		WebKitURIResponse *redirect, gpointer d);
+static void traceunref(gpointer d);
 static void updatetitle(Client *c);
+static void usercontentchanged(GFileMonitor *m, GFile *f, GFile *o,
+		GFileMonitorEvent e, gpointer d);
 static void updatewinid(Client *c);
 static void usage(void);
+static void warmup(void);
+static gboolean warmupexpired(gpointer d);
+static gboolean warmupfailed(WebKitWebView *v, WebKitLoadEvent e,
+		char *uri, GError *err, gpointer d);
+static void warmupload(WebKitWebView *v, WebKitLoadEvent e, GMainLoop *loop);
+static guint64 procrss(pid_t pid);
+static guint64 webprocmem(guint *n);
+static void webprocessterminated(WebKitWebView *v,
+		WebKitWebProcessTerminationReason r, Client *c);
+static gint slowest(gconstpointer a, gconstpointer b);
+static gint largest(gconstpointer a, gconstpointer b);
+static void writetrace(Client *c, const Arg *arg);
+static gboolean windowfocused(GtkWidget *w, GdkEvent *e, Client *c);
+static gboolean windowunmapped(GtkWidget *w, GdkEvent *e, Client *c);
 static void zoom(Client *c, const Arg *arg);
 
 /* configuration, allows nested code to access above variables */
 #include "config.h"
 
+/*
+ * Reports how many of the page's resources came from the cache, going by
+ * their Resource Timing. Cross-origin resources without Timing-Allow-Origin
+ * have no sizes and are not counted. The first contentful paint is reported
+ * too, and the web process of the page, which webext-surf.c sets surfpid to.
+ */
+static const char *perfsource =
+	"if(typeof surfpid == 'number')"
+	"	webkit.messageHandlers.surf.postMessage('pid ' + surfpid);"
+	"addEventListener('load', function() { setTimeout(function() {"
+	"	var h = 0, m = 0;"
+	"	performance.getEntriesByType('navigation').concat("
+	"			performance.getEntriesByType('resource'))"
+	"			.forEach(function(e) {"
+	"		if(!('transferSize' in e))"
+	"			return;"
+	"		if(e.transferSize > 0)"
+	"			m++;"
+	"		else if(e.decodedBodySize > 0)"
+	"			h++;"
+	"	});"
+	"	webkit.messageHandlers.surf.postMessage('cache ' + h + ' ' + m);"
+	"}, 0); });"
+	"try {"
+	"	new PerformanceObserver(function(l) {"
+	"		l.getEntries().forEach(function(e) {"
+	"			if(e.name == 'first-contentful-paint')"
+	"				webkit.messageHandlers.surf"
+	"					.postMessage('paint');"
+	"		});"
+	"	}).observe({ type: 'paint', buffered: true });"
+	"} catch(e) {}";
+
+static gboolean
+batch(void) {
+	Client *c;
+	char *uri;
+	guint i;
+
+	if(!strcmp(batchfile, "-")) {
+		batchin = stdin;
+	} else if(!(batchin = fopen(batchfile, "r"))) {
+		die("surf: cannot open %s\n", batchfile);
+	}
+	g_mkdir_with_parents(batchdir, 0755);
+
+	/* the views are reused until the list is exhausted */
+	for(i = 0; i < MAX(batchjobs, 1); i++) {
+		if(!(uri = batchline()))
+			break;
+		c = newclient(NULL);
+		batchload(c, uri);
+	}
+
+	return i > 0;
+}
+
 static void
-addaccelgroup(Client *c) {
-	int i;
-	GtkAccelGroup *group = gtk_accel_group_new();
-	GClosure *closure;
+batchdone(Client *c) {
+	gint64 now = g_get_monotonic_time();
+	char *uri;
+
+	if(--c->batchleft > 0)
+		return;
+
+	printf("%u\t%.1f\t%.1f\t%s\n", c->batchseq,
+			(c->batchload - c->batchstart) / 1000.0,
+			(now - c->batchstart) / 1000.0, c->batchuri);
+	fflush(stdout);
+
+	if((uri = batchline())) {
+		batchload(c, uri);
+	} else {
+		destroyclient(c);
+	}
+}
+
+/* the view is stopped and reused, a failure line printed */
+static gboolean
+batchexpired(gpointer d) {
+	Client *c = (Client *)d;
+	char *uri;
+
+	c->batchtimer = 0;
+	c->batchloading = FALSE;
+	webkit_web_view_stop_loading(c->view);
+	fprintf(stderr, "surf: %s: no load within %u seconds\n",
+			c->batchuri, batchtimeout);
+	printf("%u\t-\t%.1f\t%s\n", c->batchseq,
+			(g_get_monotonic_time() - c->batchstart) / 1000.0,
+			c->batchuri);
+	fflush(stdout);
+
+	if((uri = batchline())) {
+		batchload(c, uri);
+	} else {
+		destroyclient(c);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+static char *
+batchline(void) {
+	char *line = NULL;
+	size_t n = 0;
+
+	while(getline(&line, &n, batchin) > 0) {
+		g_strstrip(line);
+		if(line[0] && line[0] != '#')
+			return line;
+	}
+	free(line);
+
+	return NULL;
+}
+
+static void
+batchload(Client *c, char *uri) {
+	Arg a = { .v = uri };
+
+	free(c->batchuri);
+	c->batchuri = uri;
+	c->batchseq = batchseq++;
+	c->batchstart = g_get_monotonic_time();
+	c->batchload = 0;
+	/* set again when the load of uri starts */
+	c->batchloading = FALSE;
+	if(batchtimeout)
+		c->batchtimer = g_timeout_add_seconds(batchtimeout,
+				batchexpired, c);
+	loaduri(c, &a);
+}
+
+static char *
+batchpath(Client *c, const char *ext) {
+	return g_strdup_printf("%s/%04u.%s", batchdir, c->batchseq, ext);
+}
+
+static void
+batchpng(GObject *o, GAsyncResult *res, gpointer d) {
+	Client *c = (Client *)d;
+	cairo_surface_t *s;
+	char *path;
+
+	if((s = webkit_web_view_get_snapshot_finish(WEBKIT_WEB_VIEW(o), res,
+					NULL))) {
+		path = batchpath(c, "png");
+		cairo_surface_write_to_png(s, path);
+		cairo_surface_destroy(s);
+		g_free(path);
+	}
+	batchdone(c);
+}
+
+static void
+batchprinted(WebKitPrintOperation *p, Client *c) {
+	g_object_unref(p);
+	batchdone(c);
+}
+
+static gboolean
+batchsnapshot(gpointer d) {
+	Client *c = (Client *)d;
+	WebKitPrintOperation *p;
+	GtkPrintSettings *ps;
+	char *path, *uri;
+
+	c->settle = 0;
+	c->batchleft = 1;
+
+	if(strchr(batchoutputs, 'p')) {
+		c->batchleft++;
+		webkit_web_view_get_snapshot(c->view,
+				WEBKIT_SNAPSHOT_REGION_FULL_DOCUMENT,
+				WEBKIT_SNAPSHOT_OPTIONS_NONE, NULL, batchpng, c);
+	}
+	if(strchr(batchoutputs, 'd')) {
+		c->batchleft++;
+		path = batchpath(c, "pdf");
+		uri = g_filename_to_uri(path, NULL, NULL);
+		ps = gtk_print_settings_new();
+		gtk_print_settings_set_printer(ps, "Print to File");
+		gtk_print_settings_set(ps, GTK_PRINT_SETTINGS_OUTPUT_FILE_FORMAT,
+				"pdf");
+		gtk_print_settings_set(ps, GTK_PRINT_SETTINGS_OUTPUT_URI, uri);
+		p = webkit_print_operation_new(c->view);
+		webkit_print_operation_set_print_settings(p, ps);
+		g_signal_connect(G_OBJECT(p), "finished",
+				G_CALLBACK(batchprinted), c);
+		webkit_print_operation_print(p);
+		g_object_unref(ps);
+		g_free(uri);
+		g_free(path);
+	}
+	if(strchr(batchoutputs, 't')) {
+		c->batchleft++;
+		webkit_web_view_run_javascript(c->view,
+				"document.documentElement.innerText", NULL,
+				batchtext, c);
+	}
 
-	for(i = 0; i < LENGTH(keys); i++) {
-		closure = g_cclosure_new(G_CALLBACK(keypress), c, NULL);
-		gtk_accel_group_connect(group, keys[i].keyval, keys[i].mod,
-				0, closure);
+	/* drops the reference held by this function */
+	batchdone(c);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+batchtext(GObject *o, GAsyncResult *res, gpointer d) {
+	Client *c = (Client *)d;
+	WebKitJavascriptResult *r;
+	char *text, *path;
+
+	if((r = webkit_web_view_run_javascript_finish(WEBKIT_WEB_VIEW(o), res,
+					NULL))) {
+		text = jsresultstr(r);
+		path = batchpath(c, "txt");
+		g_file_set_contents(path, text, -1, NULL);
+		g_free(path);
+		g_free(text);
+		webkit_javascript_result_unref(r);
 	}
-	gtk_window_add_accel_group(GTK_WINDOW(c->win), group);
+	batchdone(c);
 }
 
 static void
 beforerequest(WebKitWebView *w, WebKitWebResource *r,
-		WebKitURIRequest *req,
-		gpointer d) {
-	const gchar *uri = webkit_uri_request_get_uri(req);
+		WebKitURIRequest *req, Client *c) {
+	/*
+	 * The request can not be altered here anymore, blocking is done by
+	 * the content filter compiled in loadfilters(), the rules of
+	 * rewritefile by rewriteview() for pages and by the web extension,
+	 * webext-surf.c, for everything they load.
+	 */
+	c->resources++;
+	g_signal_connect_object(G_OBJECT(r), "finished",
+			G_CALLBACK(resourcefinished), w, 0);
+	if(c->trace)
+		traceresource(c, r, req);
+}
+
+/* compiled once, the bindings of a key in the order of keys[] */
+static void
+buildkeymap(void) {
+	GSList *l;
+	gpointer key;
+	int i;
+
+	keymap = g_hash_table_new_full(NULL, NULL, NULL,
+			(GDestroyNotify)g_slist_free);
+	for(i = LENGTH(keys) - 1; i >= 0; i--) {
+		if(!keys[i].func)
+			continue;
+		key = GUINT_TO_POINTER(keys[i].keyval);
+		l = g_hash_table_lookup(keymap, key);
+		g_hash_table_steal(keymap, key);
+		g_hash_table_insert(keymap, key, g_slist_prepend(l, &keys[i]));
+	}
+}
+
+/* the directory of the absolute path, for files written later */
+static void
+builddir(const char *path) {
+	char *dir = g_path_get_dirname(path);
 
-	if(g_str_has_suffix(uri, "/favicon.ico"))
-		webkit_uri_request_set_uri(req, "about:blank");
+	g_mkdir_with_parents(dir, 0700);
+	g_chmod(dir, 0700); /* in case it existed */
+	g_free(dir);
 }
 
 static char *
 buildpath(const char *path) {
-	char *apath, *p;
+	char *apath;
 	FILE *f;
 
 	/* creating directory */
-	if(path[0] == '/') {
-		apath = g_strdup(path);
-	} else if(path[0] == '~') {
-		if(path[1] == '/') {
-			apath = g_strconcat(g_get_home_dir(), &path[1], NULL);
-		} else {
-			apath = g_strconcat(g_get_home_dir(), "/",
-					&path[1], NULL);
-		}
-	} else {
-		apath = g_strconcat(g_get_current_dir(), "/", path, NULL);
-	}
-
-	if((p = strrchr(apath, '/'))) {
-		*p = '\0';
-		g_mkdir_with_parents(apath, 0700);
-		g_chmod(apath, 0700); /* in case it existed */
-		*p = '/';
-	}
+	apath = resolvepath(path);
+	builddir(apath);
 	/* creating file (gives error when apath ends with "/") */
 	if((f = fopen(apath, "a"))) {
 		g_chmod(apath, 0600); /* always */
@@ -202,11 +683,185 @@ buildpath(const char *path) {
 
 static void
 cleanup(void) {
+	Client *c;
+	guint i;
+
+	/* quit before lateinit() ran, only its paths are needed */
+	if(!latedone) {
+		if(lateidle)
+			g_source_remove(lateidle);
+		statsfile = buildpath(statsfile);
+		downloaddir = resolvepath(downloaddir);
+		tracedir = buildpath(tracedir);
+	}
+
+	/* the final numbers of a run killed by a benchmark */
+	if(clients)
+		dumpstats(NULL);
 	while(clients)
 		destroyclient(clients);
+	if(poolfill)
+		g_source_remove(poolfill);
+	for(; pool; pool = g_list_delete_link(pool, pool)) {
+		c = pool->data;
+		gtk_widget_destroy(c->pane);
+		g_object_unref(c->pane);
+		free(c);
+	}
+	if(contentfilter)
+		webkit_user_content_filter_unref(contentfilter);
+	if(userscript)
+		webkit_user_script_unref(userscript);
+	if(usersheet)
+		webkit_user_style_sheet_unref(usersheet);
+	webkit_user_script_unref(perfscript);
+	if(keymap)
+		g_hash_table_destroy(keymap);
+	g_clear_object(&scriptmon);
+	g_clear_object(&stylemon);
 	g_free(cookiefile);
+	if(cookiestorage == WEBKIT_COOKIE_PERSISTENT_STORAGE_SQLITE)
+		g_free(cookiedb);
 	g_free(scriptfile);
 	g_free(stylefile);
+	g_free(filterfile);
+	g_free(filterstore);
+	g_free(statsfile);
+	g_free(sessionfile);
+	if(zoomsave) {
+		g_source_remove(zoomsave);
+		savezooms(NULL);
+	}
+	g_hash_table_destroy(zooms);
+	g_hash_table_destroy(zoomchanged);
+	g_free(zoomfile);
+	if(sitesave) {
+		g_source_remove(sitesave);
+		savesites(NULL);
+	}
+	g_hash_table_destroy(sites);
+	g_hash_table_destroy(sitechanged);
+	g_free(sitefile);
+	for(i = 0; i < rewrites->len; i++) {
+		g_regex_unref(g_array_index(rewrites, Rewrite, i).re);
+		g_free(g_array_index(rewrites, Rewrite, i).replacement);
+	}
+	g_array_free(rewrites, TRUE);
+	if(rewriteset)
+		g_regex_unref(rewriteset);
+	g_free(rewritefile);
+	g_free(cgroupdir);
+	g_free(downloaddir);
+	g_free(cachedir);
+	g_free(tracedir);
+	g_free(warmupfile);
+	g_list_free_full(downloads, g_object_unref);
+	g_list_free_full(dlqueue, g_free);
+	g_hash_table_destroy(prefetched);
+	g_hash_table_destroy(hosttimes);
+	g_object_unref(context);
+	if(instance) {
+		g_socket_service_stop(instance);
+		g_object_unref(instance);
+		unlink(socketfile);
+		g_free(socketfile);
+	}
+}
+
+static void
+compilefilters(WebKitUserContentFilterStore *store) {
+	char *source, **lines, *l, *p;
+	GString *json, *re;
+	GBytes *rules;
+	gboolean host;
+	int i, n = 0;
+
+	if(!g_file_get_contents(filterfile, &source, NULL, NULL))
+		return;
+
+	/*
+	 * Every line is either a host, which blocks the host and all its
+	 * subdomains, or an URL pattern where '*' matches anything.
+	 */
+	lines = g_strsplit(source, "\n", -1);
+	json = g_string_new("[");
+	re = g_string_new(NULL);
+	for(i = 0; lines[i]; i++) {
+		l = g_strstrip(lines[i]);
+		if(l[0] == '\0' || l[0] == '#')
+			continue;
+
+		host = !strpbrk(l, "/*:?");
+		g_string_assign(re, host ? "^[^:]+:(//)?([^/]*\\.)?" : "");
+		for(p = l; *p; p++) {
+			if(*p == '*') {
+				g_string_append(re, ".*");
+				continue;
+			}
+			if(strchr(".?+()[]{}^$|\\", *p))
+				g_string_append_c(re, '\\');
+			g_string_append_c(re, *p);
+		}
+		if(host)
+			g_string_append(re, "[:/]");
+
+		g_string_append(json, n++ ? ",{" : "{");
+		g_string_append(json, "\"trigger\":{\"url-filter\":");
+		jsonstr(json, re->str);
+		g_string_append(json, "},\"action\":{\"type\":\"block\"}}");
+	}
+	g_string_append_c(json, ']');
+	g_string_free(re, TRUE);
+	g_strfreev(lines);
+	g_free(source);
+
+	rules = g_string_free_to_bytes(json);
+	if(n) {
+		webkit_user_content_filter_store_save(store, "surf", rules,
+				NULL, filtersaved, NULL);
+	}
+	g_bytes_unref(rules);
+}
+
+/* not done by prepareclient(), pooled views have no window to update */
+static void
+connectview(Client *c) {
+	g_signal_connect(G_OBJECT(c->view),
+			"notify::title", /* good */
+			G_CALLBACK(titlechange), c);
+	g_signal_connect(G_OBJECT(c->view),
+			"mouse-target-changed", /* new */
+			G_CALLBACK(mousetargetchange), c);
+	g_signal_connect(G_OBJECT(c->view),
+			"permission-request", /* new */
+			G_CALLBACK(permisssionrequested), c);
+	g_signal_connect(G_OBJECT(c->view),
+			"create", /* new */
+			G_CALLBACK(createwindow), c);
+	g_signal_connect(G_OBJECT(c->view),
+			"decide-policy", /* new */
+			G_CALLBACK(decidepolicy), c);
+	g_signal_connect(G_OBJECT(c->view),
+			"load-changed", /* new */
+			G_CALLBACK(loadstatuschange), c);
+	g_signal_connect(G_OBJECT(c->view),
+			"notify::estimated-load-progress", /* new */
+			G_CALLBACK(progresschange), c);
+	g_signal_connect(G_OBJECT(c->view),
+			"context-menu", /* new */
+			G_CALLBACK(contextmenu), c);
+	g_signal_connect(G_OBJECT(c->view),
+			"resource-load-started", /* new */
+			G_CALLBACK(beforerequest), c);
+	g_signal_connect(G_OBJECT(c->view),
+			"web-process-terminated",
+			G_CALLBACK(webprocessterminated), c);
+	g_signal_connect(G_OBJECT(webkit_web_view_get_find_controller(c->view)),
+			"counted-matches",
+			G_CALLBACK(findcounted), c);
+	g_signal_connect(G_OBJECT(webkit_web_view_get_find_controller(c->view)),
+			"failed-to-find-text",
+			G_CALLBACK(findfailed), c);
 }
 
 static WebKitCookieAcceptPolicy
@@ -252,6 +907,119 @@ evalscript(JSGlobalContextRef js, char *script, char* scriptname) {
 	JSStringRelease(jsscriptname);
 }
 
+static WebKitCacheModel
+cachemodelarg(const char *s) {
+	if(!strcmp(s, "viewer"))
+		return WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER;
+	if(!strcmp(s, "document"))
+		return WEBKIT_CACHE_MODEL_DOCUMENT_BROWSER;
+	if(!strcmp(s, "browser"))
+		return WEBKIT_CACHE_MODEL_WEB_BROWSER;
+	usage();
+	return WEBKIT_CACHE_MODEL_WEB_BROWSER;
+}
+
+/*
+ * Removes the least recently used files until cachedir fits cachesize.
+ * WebKit takes a record or blob that disappeared as a miss and drops it
+ * from its index, as when its own shrinking removed it, and a file being
+ * written stays open until it is complete. The salt would make every
+ * record a miss and files written in the last minute may still be in use,
+ * both are kept.
+ */
+static guint64
+cachetrim(void) {
+	GPtrArray *dirs;
+	GArray *files;
+	GDir *d;
+	GStatBuf st;
+	const char *name;
+	char *dir, *path;
+	guint64 total = 0, freed = 0;
+	CacheFile f, *fp;
+	guint i;
+
+	/* only WebKit's own files, cachedir may hold others */
+	dir = g_build_filename(cachedir, "WebKitCache", NULL);
+	if(!g_file_test(dir, G_FILE_TEST_IS_DIR)) {
+		g_free(dir);
+		return 0;
+	}
+	dirs = g_ptr_array_new_with_free_func(g_free);
+	files = g_array_new(FALSE, FALSE, sizeof(f));
+	g_ptr_array_add(dirs, dir);
+	for(i = 0; i < dirs->len; i++) {
+		dir = dirs->pdata[i];
+		if(!(d = g_dir_open(dir, 0, NULL)))
+			continue;
+		while((name = g_dir_read_name(d))) {
+			path = g_build_filename(dir, name, NULL);
+			if(g_lstat(path, &st) < 0 || !(S_ISDIR(st.st_mode) ||
+						S_ISREG(st.st_mode))) {
+				g_free(path);
+			} else if(S_ISDIR(st.st_mode)) {
+				g_ptr_array_add(dirs, path);
+			} else if(!strcmp(name, "salt") ||
+					st.st_mtime > time(NULL) - 60) {
+				total += st.st_size;
+				g_free(path);
+			} else {
+				f.path = path;
+				f.used = MAX(st.st_atime, st.st_mtime);
+				f.size = st.st_size;
+				g_array_append_val(files, f);
+				total += st.st_size;
+			}
+		}
+		g_dir_close(d);
+	}
+
+	if(total > (guint64)cachesize << 20) {
+		g_array_sort(files, cachetrimcmp);
+		for(i = 0; i < files->len
+				&& total - freed > (guint64)cachesize << 20; i++) {
+			fp = &g_array_index(files, CacheFile, i);
+			if(g_unlink(fp->path) == 0)
+				freed += fp->size;
+		}
+	}
+
+	for(i = 0; i < files->len; i++)
+		g_free(g_array_index(files, CacheFile, i).path);
+	g_array_free(files, TRUE);
+	g_ptr_array_free(dirs, TRUE);
+
+	return freed;
+}
+
+static gint
+cachetrimcmp(gconstpointer a, gconstpointer b) {
+	const CacheFile *fa = a, *fb = b;
+
+	return (fa->used > fb->used) - (fa->used < fb->used);
+}
+
+static void
+cachetrimthread(GTask *t, gpointer o, gpointer d, GCancellable *cancel) {
+	g_task_return_int(t, cachetrim());
+}
+
+static gboolean
+cachetrimtimer(gpointer d) {
+	GTask *t;
+
+	t = g_task_new(NULL, NULL, cachetrimmeddone, NULL);
+	g_task_run_in_thread(t, cachetrimthread);
+	g_object_unref(t);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+cachetrimmeddone(GObject *o, GAsyncResult *res, gpointer d) {
+	cachetrimmed += g_task_propagate_int(G_TASK(res), NULL);
+}
+
 static void
 clipboard(Client *c, const Arg *arg) {
 	gboolean paste = *(gboolean *)arg;
@@ -269,16 +1037,46 @@ clipboard(Client *c, const Arg *arg) {
 
 static WebKitWebView *
 createwindow(WebKitWebView  *v, WebKitNavigationAction *a, Client *c) {
-	Client *n = newclient();
+	Client *n;
+
+	/* batch views have nobody to look at popups */
+	if(batchfile)
+		return NULL;
+
+	n = newclient(c);
 	return n->view;
 }
 
+static gboolean
+decidedestination(WebKitDownload *d, gchar *name, gpointer unused) {
+	char *base, *file, *path, *uri;
+	int i;
+
+	base = g_path_get_basename(name);
+	path = g_build_filename(downloaddir, base, NULL);
+	for(i = 1; g_file_test(path, G_FILE_TEST_EXISTS); i++) {
+		g_free(path);
+		file = g_strdup_printf("%s.%d", base, i);
+		path = g_build_filename(downloaddir, file, NULL);
+		g_free(file);
+	}
+
+	uri = g_filename_to_uri(path, NULL, NULL);
+	webkit_download_set_destination(d, uri);
+	g_free(uri);
+	g_free(path);
+	g_free(base);
+
+	return TRUE;
+}
+
 static gboolean
 decidepolicy (WebKitWebView *v, WebKitPolicyDecision *d,
 		WebKitPolicyDecisionType t, Client *c)
 {
 	WebKitNavigationAction *a;
 	WebKitURIRequest *r;
+	const char *m;
 	Arg arg;
 
 	switch (t) {
@@ -296,6 +1094,17 @@ decidepolicy (WebKitWebView *v, WebKitPolicyDecision *d,
 				return TRUE;
 			}
 		}
+		/*
+		 * Subframes navigate the same way, only the load that starts
+		 * belongs to the page, it is rewritten in loadstatuschange().
+		 * A load of the rewritten URI would turn a POST into a GET,
+		 * that load is left alone when it starts.
+		 */
+		m = webkit_uri_request_get_http_method(r);
+		if(m && strcmp(m, "GET")) {
+			g_free(c->posturi);
+			c->posturi = g_strdup(webkit_uri_request_get_uri(r));
+		}
 		return FALSE;
 
 	case WEBKIT_POLICY_DECISION_TYPE_NEW_WINDOW_ACTION: ;
@@ -315,8 +1124,8 @@ decidepolicy (WebKitWebView *v, WebKitPolicyDecision *d,
 		r = webkit_response_policy_decision_get_request(WEBKIT_RESPONSE_POLICY_DECISION(d));
 
 		if(!webkit_response_policy_decision_is_mime_type_supported(WEBKIT_RESPONSE_POLICY_DECISION (d))) {
-			webkit_policy_decision_ignore(d);
-			initdownload(r, c);
+			/* see downloadstarted() */
+			webkit_policy_decision_download(d);
 			return TRUE;
 		}
 		return FALSE;
@@ -330,12 +1139,53 @@ decidepolicy (WebKitWebView *v, WebKitPolicyDecision *d,
 static void
 destroyclient(Client *c) {
 	Client *p;
+	int i;
 
-	webkit_web_view_stop_loading(c->view);
-	gtk_widget_destroy(GTK_WIDGET(c->view));
+	if(c->view) {
+		webkit_web_view_stop_loading(c->view);
+		gtk_widget_destroy(GTK_WIDGET(c->view));
+	}
 	gtk_widget_destroy(c->scroll);
 	gtk_widget_destroy(c->vbox);
 	gtk_widget_destroy(c->win);
+	if(c->titleidle)
+		g_source_remove(c->titleidle);
+	if(c->batchtimer)
+		g_source_remove(c->batchtimer);
+	if(c->propidle)
+		g_source_remove(c->propidle);
+	if(c->settle)
+		g_source_remove(c->settle);
+	if(c->discardtimer)
+		g_source_remove(c->discardtimer);
+	if(c->prefetchtimer)
+		g_source_remove(c->prefetchtimer);
+	if(c->discardreport)
+		g_source_remove(c->discardreport);
+	if(c->discarding) {
+		/* the callbacks see the cancellation and leave c alone */
+		g_cancellable_cancel(c->discarding);
+		g_object_unref(c->discarding);
+	}
+	if(c->session)
+		webkit_web_view_session_state_unref(c->session);
+	g_clear_object(&c->settings);
+	if(c->sessionentry)
+		g_variant_unref(c->sessionentry);
+	if(c->trace)
+		g_ptr_array_free(c->trace, TRUE);
+	if(c->thumb)
+		cairo_surface_destroy(c->thumb);
+	g_free(c->discarduri);
+	g_free(c->findtext);
+	g_free(c->posturi);
+	free(c->batchuri);
+	for(i = 0; i < AtomLast; i++)
+		g_free(c->prop[i]);
+	g_free(c->title);
+	g_free(c->linkhover);
+	g_free(c->wintitle);
+	g_free(c->loaduri);
 
 	for(p = clients; p && p->next != c; p = p->next);
 	if(p) {
@@ -344,6 +1194,7 @@ destroyclient(Client *c) {
 		clients = c->next;
 	}
 	free(c);
+	sessiondirty = TRUE;
 	if(clients == NULL)
 		gtk_main_quit();
 }
@@ -364,91 +1215,780 @@ die(const char *errstr, ...) {
 }
 
 static void
-find(Client *c, const Arg *arg) {
-	const char *s;
-	WebKitFindController *f;
+discard(Client *c) {
+	if(!c->view || c->discarding || batchfile || inuse(c))
+		return;
 
-	f = webkit_web_view_get_find_controller(c->view);
-	s = getatom(c, AtomFind);
-	gboolean forward = *(gboolean *)arg;
-	webkit_find_controller_search (f, s,
-		WEBKIT_FIND_OPTIONS_CASE_INSENSITIVE | WEBKIT_FIND_OPTIONS_WRAP_AROUND |
-		(forward ? WEBKIT_FIND_OPTIONS_NONE : WEBKIT_FIND_OPTIONS_BACKWARDS),
-		G_MAXUINT);
+	c->discarding = g_cancellable_new();
+	webkit_web_view_run_javascript_in_world(c->view,
+			"window.scrollX + ' ' + window.scrollY", "surf",
+			c->discarding, discardscroll, c);
 }
 
-static void
-fullscreen(Client *c, const Arg *arg) {
-	if(c->fullscreen) {
-		gtk_window_unfullscreen(GTK_WINDOW(c->win));
+static gboolean
+discardcheck(gpointer d) {
+	Client *c = (Client *)d;
+	gint64 idle = (g_get_monotonic_time() - c->active) / G_USEC_PER_SEC;
+
+	c->discardtimer = 0;
+	if(!c->view)
+		return G_SOURCE_REMOVE;
+
+	if(gtk_window_is_active(GTK_WINDOW(c->win))) {
+		c->discardtimer = g_timeout_add_seconds(discardidle,
+				discardcheck, c);
+	} else if(idle < discardidle) {
+		c->discardtimer = g_timeout_add_seconds(discardidle - idle,
+				discardcheck, c);
 	} else {
-		gtk_window_fullscreen(GTK_WINDOW(c->win));
+		discard(c);
+		/* kept, for example because it plays audio */
+		if(!c->discarding)
+			c->discardtimer = g_timeout_add_seconds(discardidle,
+					discardcheck, c);
 	}
-	c->fullscreen = !c->fullscreen;
+
+	return G_SOURCE_REMOVE;
 }
 
+/* the web process exits asynchronously, look at it a bit later */
 static gboolean
-permisssionrequested(WebKitWebView *v, WebKitPermissionRequest *r,
-		Client *c) {
-	if (!WEBKIT_IS_GEOLOCATION_PERMISSION_REQUEST(r)) {
-		return FALSE;
-	}
+discardreport(gpointer d) {
+	Client *c = (Client *)d;
+	guint64 rss, freed;
+	guint n;
 
-	if(allowgeolocation) {
-		webkit_permission_request_allow(r);
-	} else {
-		webkit_permission_request_deny(r);
-	}
-	return TRUE;
-}
+	c->discardreport = 0;
+	rss = webprocmem(&n);
+	freed = c->discardrss > rss ? c->discardrss - rss : 0;
+	discardedbytes += freed;
+	fprintf(stderr, "surf: discarded %s, %" G_GUINT64_FORMAT
+			" kB reclaimed\n", c->discarduri, freed / 1024);
 
-static const char *
-getatom(Client *c, int a) {
-	static char buf[BUFSIZ];
-	Atom adummy;
-	int idummy;
-	unsigned long ldummy;
-	unsigned char *p = NULL;
+	return G_SOURCE_REMOVE;
+}
 
-	XGetWindowProperty(dpy, GDK_WINDOW_XID(gtk_widget_get_window(GTK_WIDGET(c->win))),
-			atoms[a], 0L, BUFSIZ, False, XA_STRING,
-			&adummy, &idummy, &ldummy, &ldummy, &p);
-	if(p) {
-		strncpy(buf, (char *)p, LENGTH(buf)-1);
+static void
+discardscroll(GObject *o, GAsyncResult *res, gpointer d) {
+	Client *c = (Client *)d;
+	WebKitJavascriptResult *r;
+	GError *err = NULL;
+	char *s;
+
+	if(!(r = webkit_web_view_run_javascript_in_world_finish(
+					WEBKIT_WEB_VIEW(o), res, &err))) {
+		if(g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_error_free(err);
+			return;
+		}
+		g_error_free(err);
 	} else {
-		buf[0] = '\0';
+		s = jsresultstr(r);
+		sscanf(s, "%ld %ld", &c->scrollx, &c->scrolly);
+		g_free(s);
+		webkit_javascript_result_unref(r);
 	}
-	XFree(p);
 
-	return buf;
+	webkit_web_view_get_snapshot(c->view, WEBKIT_SNAPSHOT_REGION_VISIBLE,
+			WEBKIT_SNAPSHOT_OPTIONS_NONE, c->discarding,
+			discardsnapshot, c);
 }
 
-static char *
-geturi(Client *c) {
-	char *uri;
+static void
+discardsnapshot(GObject *o, GAsyncResult *res, gpointer d) {
+	Client *c = (Client *)d;
+	cairo_surface_t *s;
+	cairo_t *cr;
+	GError *err = NULL;
+	double f;
+	guint n;
+	int w, h;
+
+	if(!(s = webkit_web_view_get_snapshot_finish(WEBKIT_WEB_VIEW(o), res,
+					&err))) {
+		if(g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_error_free(err);
+			return;
+		}
+		g_error_free(err);
+	} else {
+		/* a quarter of the size is enough to recognize the page */
+		w = cairo_image_surface_get_width(s);
+		h = cairo_image_surface_get_height(s);
+		f = 0.25;
+		c->thumb = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+				MAX(w * f, 1), MAX(h * f, 1));
+		cr = cairo_create(c->thumb);
+		cairo_scale(cr, f, f);
+		cairo_set_source_surface(cr, s, 0, 0);
+		cairo_paint(cr);
+		cairo_destroy(cr);
+		cairo_surface_destroy(s);
+	}
+	g_clear_object(&c->discarding);
 
-	if(!(uri = (char *)webkit_web_view_get_uri(c->view)))
-		uri = "about:blank";
-	return uri;
+	c->discardrss = webprocmem(&n);
+	c->discarduri = g_strdup(geturi(c));
+	c->session = webkit_web_view_get_session_state(c->view);
+	discardview(c);
+
+	discards++;
+	c->discardreport = g_timeout_add_seconds(2, discardreport, c);
 }
 
-static gboolean
-initdownload(WebKitURIRequest *r, Client *c) {
-	Arg arg;
+/* c->session and c->discarduri are left to the caller */
+static void
+discardview(Client *c) {
+	c->discardzoom = webkit_web_view_get_zoom_level(c->view);
+	c->settings = g_object_ref(webkit_web_view_get_settings(c->view));
 
-	updatewinid(c);
-	arg = (Arg)DOWNLOAD((char *)webkit_uri_request_get_uri(r), geturi(c));
-	spawn(c, &arg);
-	return FALSE;
+	webkit_web_view_stop_loading(c->view);
+	gtk_widget_destroy(GTK_WIDGET(c->view));
+	c->view = NULL;
+	c->webpid = 0;
+	c->inspector = NULL;
+	c->isinspecting = false;
+	c->scrolltick = 0;
+	c->scrolldx = c->scrolldy = 0;
+	g_free(c->findtext);
+	c->findtext = NULL;
+
+	c->placeholder = gtk_drawing_area_new();
+	g_signal_connect(G_OBJECT(c->placeholder), "draw",
+			G_CALLBACK(drawthumb), c);
+	gtk_widget_hide(c->scroll);
+	gtk_box_pack_start(GTK_BOX(c->vbox), c->placeholder, TRUE, TRUE, 0);
+	gtk_widget_show(c->placeholder);
 }
 
 static void
-inspector(Client *c, const Arg *arg) {
-	if(c->isinspecting) {
-		webkit_web_inspector_close(c->inspector);
-	} else {
-		webkit_web_inspector_show(c->inspector);
-	}
+downloadfailed(WebKitDownload *d, GError *err, gpointer unused) {
+	fprintf(stderr, "surf: download %s: %s\n",
+			webkit_uri_request_get_uri(webkit_download_get_request(d)),
+			err->message);
+	g_object_set_data(G_OBJECT(d), "failed", GINT_TO_POINTER(1));
+}
+
+static void
+downloadfinished(WebKitDownload *d, gpointer unused) {
+	WebKitWebView *v;
+	Client *c;
+	Arg arg;
+	char *path, *uri;
+
+	downloads = g_list_remove(downloads, d);
+	if(!g_object_get_data(G_OBJECT(d), "failed")) {
+		dlcompleted++;
+		path = g_filename_from_uri(webkit_download_get_destination(d),
+				NULL, NULL);
+		arg = (Arg)DOWNLOADDONE(path);
+		spawn(NULL, &arg);
+		g_free(path);
+	}
+	if((v = webkit_download_get_web_view(d)) && (c = getclient(v)))
+		updatetitle(c);
+	g_object_unref(d);
+
+	if(dlqueue) {
+		uri = dlqueue->data;
+		dlqueue = g_list_delete_link(dlqueue, dlqueue);
+		webkit_web_context_download_uri(context, uri);
+		g_free(uri);
+	}
+}
+
+static void
+downloadprogress(WebKitDownload *d, GParamSpec *pspec, gpointer unused) {
+	WebKitWebView *v;
+	Client *c;
+
+	if((v = webkit_download_get_web_view(d)) && (c = getclient(v)))
+		updatetitle(c);
+}
+
+static void
+downloadstarted(WebKitWebContext *ctx, WebKitDownload *d, gpointer unused) {
+	/*
+	 * WebKit can not pause downloads, queued ones start over later as a
+	 * GET of their URI, see surf.1
+	 */
+	if(g_list_length(downloads) >= MAX(maxdownloads, 1)) {
+		dlqueue = g_list_append(dlqueue, g_strdup(
+					webkit_uri_request_get_uri(
+						webkit_download_get_request(d))));
+		webkit_download_cancel(d);
+		return;
+	}
+
+	downloads = g_list_append(downloads, g_object_ref(d));
+	g_signal_connect(G_OBJECT(d), "decide-destination",
+			G_CALLBACK(decidedestination), NULL);
+	g_signal_connect(G_OBJECT(d), "notify::estimated-progress",
+			G_CALLBACK(downloadprogress), NULL);
+	g_signal_connect(G_OBJECT(d), "failed",
+			G_CALLBACK(downloadfailed), NULL);
+	g_signal_connect(G_OBJECT(d), "finished",
+			G_CALLBACK(downloadfinished), NULL);
+}
+
+static gboolean
+drawthumb(GtkWidget *w, cairo_t *cr, Client *c) {
+	if(!c->thumb)
+		return FALSE;
+
+	cairo_scale(cr, (double)gtk_widget_get_allocated_width(w)
+			/ cairo_image_surface_get_width(c->thumb),
+			(double)gtk_widget_get_allocated_height(w)
+			/ cairo_image_surface_get_height(c->thumb));
+	cairo_set_source_surface(cr, c->thumb, 0, 0);
+	cairo_paint(cr);
+
+	return TRUE;
+}
+
+static gboolean
+dumpstats(gpointer d) {
+	GString *s;
+	GError *err = NULL;
+	GHashTableIter it;
+	HostTimes *t;
+	Client *c;
+	char *host;
+	guint64 rss, self = 0;
+	guint n;
+	char *statm;
+
+	rss = webprocmem(&n);
+	if(g_file_get_contents("/proc/self/statm", &statm, NULL, NULL)) {
+		self = g_ascii_strtoull(strchr(statm, ' ') + 1, NULL, 10)
+			* sysconf(_SC_PAGESIZE);
+		g_free(statm);
+	}
+	s = g_string_new(NULL);
+	g_string_append_printf(s, "{\n\t\"pid\": %d,\n"
+			"\t\"rss\": %" G_GUINT64_FORMAT ",\n"
+			"\t\"startup\": %.1f,\n"
+			"\t\"webprocesses\": { \"model\": \"%s\", "
+			"\"limit\": %u, \"count\": %u, "
+			"\"rss\": %" G_GUINT64_FORMAT " },\n"
+			"\t\"downloads\": { \"active\": %u, \"queued\": %u, "
+			"\"completed\": %u },\n"
+			"\t\"pool\": { \"size\": %u, \"hits\": %u, "
+			"\"misses\": %u },\n"
+			"\t\"titles\": { \"updates\": %u, "
+			"\"peakpersecond\": %u },\n"
+			"\t\"discards\": { \"count\": %u, "
+			"\"reclaimed\": %" G_GUINT64_FORMAT " },\n"
+			"\t\"cache\": { \"hits\": %u, \"misses\": %u, "
+			"\"trimmed\": %" G_GUINT64_FORMAT " },\n"
+			"\t\"prefetch\": { \"hosts\": %u, \"budget\": %u, "
+			"\"navigations\": %u, \"commitprefetched\": %.1f, "
+			"\"commitother\": %.1f },\n"
+			"\t\"scroll\": { \"frames\": %u, \"jank\": %u },\n"
+			"\t\"memorylow\": { \"cleared\": %u, "
+			"\"discarded\": %u, \"restarted\": %u, "
+			"\"reclaimed\": %" G_GUINT64_FORMAT " },\n"
+			"\t\"clients\": [",
+			(int)getpid(), self, startupcommit / 1000.0,
+			processmodel == WEBKIT_PROCESS_MODEL_SHARED_SECONDARY_PROCESS
+			? "shared" : "multiple", webprocesses, n, rss,
+			g_list_length(downloads),
+			g_list_length(dlqueue), dlcompleted,
+			g_list_length(pool), poolhits,
+			poolmisses, titleupdates, titlepeak, discards,
+			discardedbytes, cachehits, cachemisses, cachetrimmed,
+			prefetches, prefetchbudget, prefetchhits,
+			commitsprefetched ? commitprefetched / 1000.0
+			/ commitsprefetched : 0.0,
+			commitsother ? commitother / 1000.0 / commitsother : 0.0,
+			scrollframes, scrolljank, memorysteps[0],
+			memorysteps[1], memorysteps[2], memoryreclaimed);
+	for(c = clients; c; c = c->next) {
+		g_string_append(s, c == clients ? "\n\t\t{ \"uri\": "
+				: ",\n\t\t{ \"uri\": ");
+		jsonstr(s, geturi(c));
+		g_string_append_printf(s, ", \"resources\": %u, "
+				"\"bytes\": %" G_GUINT64_FORMAT ", "
+				"\"cachehits\": %u, \"cachemisses\": %u, "
+				"\"firstcommit\": %.1f, \"lastcommit\": %.1f, "
+				"\"lastfinish\": %.1f }",
+				c->resources, c->bytes, c->cachehits,
+				c->cachemisses, c->firstcommit / 1000.0,
+				c->lastcommit / 1000.0, c->lastfinish / 1000.0);
+	}
+	g_string_append(s, "\n\t],\n\t\"hosts\": {");
+	n = 0;
+	g_hash_table_iter_init(&it, hosttimes);
+	while(g_hash_table_iter_next(&it, (gpointer *)&host, (gpointer *)&t)) {
+		g_string_append(s, n++ ? ",\n\t\t" : "\n\t\t");
+		jsonstr(s, host);
+		g_string_append_printf(s, ": { \"loads\": %u, ", t->loads);
+		jsontimes(s, "commit", t->commit);
+		g_string_append(s, ", ");
+		jsontimes(s, "paint", t->paint);
+		g_string_append(s, ", ");
+		jsontimes(s, "finish", t->finish);
+		g_string_append(s, " }");
+	}
+	g_string_append(s, "\n\t},\n\t\"rewrites\": [");
+	for(n = 0; n < rewrites->len; n++) {
+		g_string_append(s, n ? ",\n\t\t{ \"pattern\": "
+				: "\n\t\t{ \"pattern\": ");
+		jsonstr(s, g_regex_get_pattern(g_array_index(rewrites,
+						Rewrite, n).re));
+		g_string_append_printf(s, ", \"hits\": %u }",
+				g_array_index(rewrites, Rewrite, n).hits);
+	}
+	g_string_append(s, "\n\t]\n}\n");
+
+	if(!g_file_set_contents(statsfile, s->str, s->len, &err)) {
+		fprintf(stderr, "surf: %s\n", err->message);
+		g_error_free(err);
+	}
+	g_string_free(s, TRUE);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+freehosttimes(gpointer d) {
+	HostTimes *t = (HostTimes *)d;
+
+	g_array_free(t->commit, TRUE);
+	g_array_free(t->paint, TRUE);
+	g_array_free(t->finish, TRUE);
+	g_free(t);
+}
+
+static gboolean
+fillpool(gpointer d) {
+	Client *c;
+
+	if(g_list_length(pool) >= poolsize) {
+		poolfill = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	c = prepareclient(NULL);
+	/* spawns the web process */
+	webkit_web_view_load_uri(c->view, "about:blank");
+	pool = g_list_append(pool, c);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+filterloaded(GObject *o, GAsyncResult *res, gpointer d) {
+	WebKitUserContentFilterStore *store = WEBKIT_USER_CONTENT_FILTER_STORE(o);
+
+	/* no usable compiled list, build it from filterfile */
+	if(!(contentfilter = webkit_user_content_filter_store_load_finish(
+					store, res, NULL))) {
+		compilefilters(store);
+		return;
+	}
+	filtersaved(NULL, NULL, NULL);
+}
+
+static void
+filtersaved(GObject *o, GAsyncResult *res, gpointer d) {
+	GError *err = NULL;
+	Client *c;
+	GList *l;
+
+	if(o && !(contentfilter = webkit_user_content_filter_store_save_finish(
+					WEBKIT_USER_CONTENT_FILTER_STORE(o), res,
+					&err))) {
+		fprintf(stderr, "surf: %s: %s\n", filterfile, err->message);
+		g_error_free(err);
+		return;
+	}
+
+	for(c = clients; c; c = c->next) {
+		/* restore() adds it to discarded views */
+		if(!c->view)
+			continue;
+		webkit_user_content_manager_add_filter(
+				webkit_web_view_get_user_content_manager(c->view),
+				contentfilter);
+	}
+	for(l = pool; l; l = l->next) {
+		webkit_user_content_manager_add_filter(
+				webkit_web_view_get_user_content_manager(
+					((Client *)l->data)->view),
+				contentfilter);
+	}
+}
+
+static void
+find(Client *c, const Arg *arg) {
+	const char *s;
+	WebKitFindController *f;
+	guint opts = WEBKIT_FIND_OPTIONS_CASE_INSENSITIVE |
+		WEBKIT_FIND_OPTIONS_WRAP_AROUND;
+
+	f = webkit_web_view_get_find_controller(c->view);
+	s = getatom(c, AtomFind);
+
+	/*
+	 * The same needle only moves to the next match, without any it is
+	 * searched again, text may have been added meanwhile.
+	 */
+	if(c->findtext && !strcmp(s, c->findtext) && c->findcount) {
+		c->findmoved = TRUE;
+		if(arg->b) {
+			webkit_find_controller_search_next(f);
+			c->findmatch = c->findmatch % c->findcount + 1;
+		} else {
+			webkit_find_controller_search_previous(f);
+			c->findmatch = c->findmatch > 1 ?
+				c->findmatch - 1 : c->findcount;
+		}
+		updatetitle(c);
+		return;
+	}
+
+	/* a new needle cancels the search still running */
+	webkit_find_controller_search_finish(f);
+	g_free(c->findtext);
+	c->findtext = NULL;
+	c->findmatch = c->findcount = 0;
+	c->findmoved = FALSE;
+	if(*s) {
+		c->findtext = g_strdup(s);
+		if(!arg->b)
+			opts |= WEBKIT_FIND_OPTIONS_BACKWARDS;
+		webkit_find_controller_count_matches(f, s, opts, findmax);
+		webkit_find_controller_search(f, s, opts, findmax);
+	}
+	updatetitle(c);
+}
+
+static void
+findcounted(WebKitFindController *f, guint n, Client *c) {
+	if(g_strcmp0(webkit_find_controller_get_search_text(f), c->findtext))
+		return;
+	c->findcount = n;
+	c->findmatch = n ? 1 : 0;
+	updatetitle(c);
+}
+
+static void
+findfailed(WebKitFindController *f, Client *c) {
+	c->findmatch = c->findcount = 0;
+	updatetitle(c);
+}
+
+static gboolean
+flushatoms(gpointer d) {
+	Client *c = (Client *)d;
+	Window w = GDK_WINDOW_XID(gtk_widget_get_window(GTK_WIDGET(c->win)));
+	int a;
+
+	c->propidle = 0;
+	for(a = 0; a < AtomLast; a++) {
+		if(!(c->propdirty & (1 << a)))
+			continue;
+		XChangeProperty(dpy, w, atoms[a], XA_STRING, 8, PropModeReplace,
+				(unsigned char *)c->prop[a],
+				strlen(c->prop[a]) + 1);
+		/* processx() will see this change too */
+		c->propskip[a]++;
+	}
+	c->propdirty = 0;
+	XFlush(dpy);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+fullscreen(Client *c, const Arg *arg) {
+	if(c->fullscreen) {
+		gtk_window_unfullscreen(GTK_WINDOW(c->win));
+	} else {
+		gtk_window_fullscreen(GTK_WINDOW(c->win));
+	}
+	c->fullscreen = !c->fullscreen;
+}
+
+/*
+ * Memory is low when less than memoryavail MB are available to the system
+ * or left below memory.max of our cgroup, or when its tasks stalled on
+ * memory for memorypressure percent of the last 10 seconds. Every check it
+ * stays low goes a step further.
+ */
+static gboolean
+memorycheck(gpointer d) {
+	Client *c, *a, *largest = NULL;
+	guint64 avail = G_MAXUINT64, max, current, rss, largestrss = 0;
+	gdouble some = 0;
+	char *buf, *p, *path;
+	gboolean keep;
+	guint n;
+
+	if(g_file_get_contents("/proc/meminfo", &buf, NULL, NULL)) {
+		if((p = strstr(buf, "MemAvailable:")))
+			avail = g_ascii_strtoull(p + 13, NULL, 10) * 1024;
+		g_free(buf);
+	}
+	if(cgroupdir) {
+		path = g_build_filename(cgroupdir, "memory.max", NULL);
+		if(g_file_get_contents(path, &buf, NULL, NULL)) {
+			max = g_ascii_strtoull(buf, NULL, 10);
+			g_free(buf);
+			g_free(path);
+			path = g_build_filename(cgroupdir, "memory.current",
+					NULL);
+			/* "max" reads as 0, no limit */
+			if(max && g_file_get_contents(path, &buf, NULL, NULL)) {
+				current = g_ascii_strtoull(buf, NULL, 10);
+				avail = MIN(avail, max > current ?
+						max - current : 0);
+				g_free(buf);
+			}
+		}
+		g_free(path);
+		path = g_build_filename(cgroupdir, "memory.pressure", NULL);
+		if(g_file_get_contents(path, &buf, NULL, NULL)) {
+			if((p = strstr(buf, "some avg10=")))
+				some = g_ascii_strtod(p + 11, NULL);
+			g_free(buf);
+		}
+		g_free(path);
+	}
+
+	if(avail >= (guint64)memoryavail * 1024 * 1024 &&
+			some < memorypressure) {
+		memorylevel = 0;
+		return G_SOURCE_CONTINUE;
+	}
+	/* the last step is not measured yet */
+	if(memoryreportid)
+		return G_SOURCE_CONTINUE;
+
+	memorylevel = MIN(memorylevel + 1, LENGTH(memoryactions));
+	memoryrss = webprocmem(&n);
+	switch(memorylevel) {
+	case 1:
+		webkit_web_context_clear_cache(context);
+		webkit_web_context_garbage_collect_javascript_objects(context);
+		break;
+	case 2:
+		for(c = clients; c; c = c->next) {
+			if(!gtk_window_is_active(GTK_WINDOW(c->win)))
+				discard(c);
+		}
+		break;
+	case 3:
+		/*
+		 * With a shared process every window would go, else one at
+		 * most every memorycooldown seconds. The web process with
+		 * the largest RSS, as webext-surf.c reports them, of which no
+		 * view is focused or in use.
+		 */
+		if(processmodel ==
+				WEBKIT_PROCESS_MODEL_SHARED_SECONDARY_PROCESS ||
+				(memoryrestarted && g_get_monotonic_time()
+				 - memoryrestarted < memorycooldown
+				 * G_USEC_PER_SEC))
+			return G_SOURCE_CONTINUE;
+		for(c = clients; c; c = c->next) {
+			if(!c->view || !c->webpid || (largest &&
+						c->webpid == largest->webpid))
+				continue;
+			keep = FALSE;
+			for(a = clients; a && !keep; a = a->next) {
+				keep = a->view && a->webpid == c->webpid &&
+					(a->discarding || inuse(a) ||
+					 gtk_window_is_active(
+						 GTK_WINDOW(a->win)));
+			}
+			if(!keep && (rss = procrss(c->webpid)) > largestrss) {
+				largest = c;
+				largestrss = rss;
+			}
+		}
+		if(!largest)
+			return G_SOURCE_CONTINUE;
+		/* its views load again, see webprocessterminated() */
+		memoryrestarted = g_get_monotonic_time();
+		webkit_web_view_terminate_web_process(largest->view);
+		break;
+	}
+	memorysteps[memorylevel - 1]++;
+	memoryreportid = g_timeout_add_seconds(2, memoryreport,
+			GUINT_TO_POINTER(memorylevel));
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* web processes free memory asynchronously, look at them a bit later */
+static gboolean
+memoryreport(gpointer d) {
+	guint64 rss, freed;
+	guint n, step = GPOINTER_TO_UINT(d);
+
+	memoryreportid = 0;
+	rss = webprocmem(&n);
+	freed = memoryrss > rss ? memoryrss - rss : 0;
+	memoryreclaimed += freed;
+	fprintf(stderr, "surf: memory low, %s, %" G_GUINT64_FORMAT
+			" kB reclaimed\n", memoryactions[step - 1],
+			freed / 1024);
+
+	return G_SOURCE_REMOVE;
+}
+
+static GFileMonitor *
+monitorfile(const char *path) {
+	GFileMonitor *m;
+	GFile *f;
+
+	f = g_file_new_for_path(path);
+	m = g_file_monitor_file(f, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+	g_object_unref(f);
+	if(m) {
+		g_signal_connect(G_OBJECT(m), "changed",
+				G_CALLBACK(usercontentchanged), NULL);
+	}
+
+	return m;
+}
+
+static gboolean
+permisssionrequested(WebKitWebView *v, WebKitPermissionRequest *r,
+		Client *c) {
+	if (!WEBKIT_IS_GEOLOCATION_PERMISSION_REQUEST(r)) {
+		return FALSE;
+	}
+
+	if(c->geolocation) {
+		webkit_permission_request_allow(r);
+	} else {
+		webkit_permission_request_deny(r);
+	}
+	return TRUE;
+}
+
+static const char *
+getatom(Client *c, int a) {
+	return c->prop[a] ? c->prop[a] : "";
+}
+
+static Client *
+getclient(WebKitWebView *v) {
+	Client *c;
+
+	for(c = clients; c && c->view != v; c = c->next);
+	return c;
+}
+
+static char *
+gethost(const char *uri) {
+	SoupURI *u;
+	char *host = NULL;
+
+	if(uri && (u = soup_uri_new(uri))) {
+		host = g_strdup(u->host);
+		soup_uri_free(u);
+	}
+	return host;
+}
+
+static char *
+geturi(Client *c) {
+	char *uri;
+
+	if(!c->view)
+		uri = c->discarduri;
+	else
+		uri = (char *)webkit_web_view_get_uri(c->view);
+	if(!uri)
+		uri = "about:blank";
+	return uri;
+}
+
+static void
+importcookies(WebKitCookieManager *cm) {
+	SoupCookieJar *jar;
+	GSList *cookies, *l;
+	char *done;
+
+	/* the database is written lazily, "cookies.db.imported" marks it */
+	done = g_strconcat(cookiedb, ".imported", NULL);
+	if(g_file_test(done, G_FILE_TEST_EXISTS)) {
+		g_free(done);
+		return;
+	}
+
+	jar = soup_cookie_jar_text_new(cookiefile, TRUE);
+	cookies = soup_cookie_jar_all_cookies(jar);
+	for(l = cookies; l; l = l->next)
+		webkit_cookie_manager_add_cookie(cm, l->data, NULL, NULL, NULL);
+	g_file_set_contents(done, "", 0, NULL);
+
+	g_slist_free_full(cookies, (GDestroyNotify)soup_cookie_free);
+	g_object_unref(jar);
+	g_free(done);
+}
+
+static gboolean
+instanceconnect(GSocketService *s, GSocketConnection *conn, GObject *src,
+		gpointer d) {
+	GDataInputStream *in;
+
+	in = g_data_input_stream_new(g_io_stream_get_input_stream(
+				G_IO_STREAM(conn)));
+	g_object_set_data_full(G_OBJECT(in), "connection",
+			g_object_ref(conn), g_object_unref);
+	g_data_input_stream_read_line_async(in, G_PRIORITY_DEFAULT, NULL,
+			instanceread, NULL);
+
+	return TRUE;
+}
+
+static void
+instanceread(GObject *o, GAsyncResult *res, gpointer d) {
+	GDataInputStream *in = G_DATA_INPUT_STREAM(o);
+	char *line, *uri;
+	Window xid;
+
+	if(!(line = g_data_input_stream_read_line_finish(in, res, NULL, NULL))) {
+		g_object_unref(in);
+		return;
+	}
+
+	/* "xid uri", xid is 0 for a toplevel window */
+	xid = strtoul(line, &uri, 0);
+	if(*uri == ' ')
+		uri++;
+	openwindow(*uri ? uri : NULL, xid);
+	g_free(line);
+
+	g_data_input_stream_read_line_async(in, G_PRIORITY_DEFAULT, NULL,
+			instanceread, NULL);
+}
+
+static void
+inspector(Client *c, const Arg *arg) {
+	if(!enableinspector)
+		return;
+
+	/* set up on first use */
+	if(!c->inspector) {
+		c->inspector = webkit_web_view_get_inspector(c->view);
+		g_signal_connect(G_OBJECT(c->inspector), "attach",
+				G_CALLBACK(inspector_show), c);
+		g_signal_connect(G_OBJECT(c->inspector), "closed",
+				G_CALLBACK(inspector_close), c);
+		c->isinspecting = false;
+	}
+
+	if(c->isinspecting) {
+		webkit_web_inspector_close(c->inspector);
+	} else {
+		webkit_web_inspector_show(c->inspector);
+	}
 }
 
 static gboolean
@@ -463,197 +2003,992 @@ inspector_close(WebKitWebInspector *i, Client *c) {
 	return FALSE;
 }
 
+/* the page plays audio or downloads, it is not to go away */
 static gboolean
-keypress(GtkAccelGroup *group, GObject *obj,
-		guint key, GdkModifierType mods, Client *c) {
-	guint i;
+inuse(Client *c) {
+	GList *l;
+
+	if(webkit_web_view_is_playing_audio(c->view))
+		return TRUE;
+	for(l = downloads; l; l = l->next) {
+		if(webkit_download_get_web_view(l->data) == c->view)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+jsonstr(GString *s, const char *str) {
+	g_string_append_c(s, '"');
+	for(; str && *str; str++) {
+		if(*str == '"' || *str == '\\') {
+			g_string_append_c(s, '\\');
+			g_string_append_c(s, *str);
+		} else if((unsigned char)*str < 0x20) {
+			g_string_append_printf(s, "\\u%04x", *str);
+		} else {
+			g_string_append_c(s, *str);
+		}
+	}
+	g_string_append_c(s, '"');
+}
+
+static gboolean
+keypress(GtkWidget *w, GdkEventKey *ev, Client *c) {
+	GSList *l;
+	Key *k;
+	guint key, mods, n;
 	gboolean processed = FALSE;
+	int i;
 
-	mods = CLEANMASK(mods);
-	key = gdk_keyval_to_lower(key);
-	updatewinid(c);
-	for(i = 0; i < LENGTH(keys); i++) {
-		if(key == keys[i].keyval
-				&& mods == keys[i].mod
-				&& keys[i].func) {
-			keys[i].func(c, &(keys[i].arg));
+	if(ev->is_modifier)
+		return FALSE;
+	c->active = g_get_monotonic_time();
+	restore(c);
+
+	/* keys of other layouts are bound by their key in the first one */
+	for(i = 0; i < 2 && !processed; i++) {
+		if(i && !ev->group)
+			break;
+		key = translatekey(w, ev, i ? 0 : ev->group, &mods);
+		for(l = g_hash_table_lookup(keymap, GUINT_TO_POINTER(key)); l;
+				l = l->next) {
+			k = l->data;
+			if(mods != k->mod || (k->mode && k->mode != c->mode))
+				continue;
+			/* only moving around is repeated by a count */
+			n = k->func == scroll_v || k->func == scroll_h ||
+				k->func == zoom || k->func == navigate ||
+				k->func == find ? MAX(c->count, 1) : 1;
+			for(; n > 0; n--)
+				k->func(c, &k->arg);
 			processed = TRUE;
 		}
 	}
 
-	return processed;
+	/* unbound digits are a count for the next binding */
+	if(!processed && key >= GDK_KEY_0 && key <= GDK_KEY_9 &&
+			(key != GDK_KEY_0 || c->count) &&
+			(mods == MODKEY ||
+			 (!mods && c->mode == ModeNormal))) {
+		c->count = MIN(c->count * 10 + key - GDK_KEY_0, 999);
+		updatetitle(c);
+		return TRUE;
+	}
+	if(c->count) {
+		c->count = 0;
+		updatetitle(c);
+	}
+
+	/* typed text does not reach the page in normal mode */
+	return processed || (!mods && c->mode == ModeNormal);
 }
 
+/* ISO 8601 in UTC, t as returned by g_get_real_time() */
 static void
-mousetargetchange(WebKitWebView *v, WebKitHitTestResult *r,
-		guint modifiers, Client *c) {
-	if(webkit_hit_test_result_context_is_link(r)) {
-		c->linkhover = webkit_hit_test_result_get_link_uri(r);
-	} else if(c->linkhover) {
-		c->linkhover = NULL;
-	}
-	updatetitle(c);
+jsontime(GString *s, gint64 t) {
+	GDateTime *dt;
+	char *f;
+
+	dt = g_date_time_new_from_unix_utc(t / G_USEC_PER_SEC);
+	f = g_date_time_format(dt, "%Y-%m-%dT%H:%M:%S");
+	g_string_append_printf(s, "\"%s.%03dZ\"", f,
+			(int)(t % G_USEC_PER_SEC / 1000));
+	g_free(f);
+	g_date_time_unref(dt);
 }
 
-static void
-loadstatuschange(WebKitWebView *v, WebKitLoadEvent e, Client *c) {
-	GTlsCertificateFlags errors;
-	char *uri;
+static gint
+cmpdouble(gconstpointer a, gconstpointer b) {
+	gdouble x = *(const gdouble *)a, y = *(const gdouble *)b;
 
-	switch(e) {
-	case WEBKIT_LOAD_STARTED:
-		c->progress = 0;
-		c->title = geturi(c);
+	return (x > y) - (x < y);
+}
+
+static void
+jsontimes(GString *s, const char *name, GArray *a) {
+	GArray *sorted;
+	const double p[] = { 0.50, 0.95, 0.99 };
+	const char *pn[] = { "p50", "p95", "p99" };
+	guint i, n;
+
+	g_string_append_printf(s, "\"%s\": {", name);
+	if(a->len) {
+		sorted = g_array_sized_new(FALSE, FALSE, sizeof(gdouble),
+				a->len);
+		g_array_append_vals(sorted, a->data, a->len);
+		g_array_sort(sorted, cmpdouble);
+		for(i = 0; i < LENGTH(p); i++) {
+			n = (guint)(p[i] * a->len + 0.999999);
+			g_string_append_printf(s, "%s \"%s\": %.1f",
+					i ? "," : "", pn[i],
+					g_array_index(sorted, gdouble,
+						MAX(n, 1) - 1));
+		}
+		g_array_free(sorted, TRUE);
+	}
+	g_string_append(s, " }");
+}
+
+static char *
+jsresultstr(WebKitJavascriptResult *r) {
+	JSStringRef js;
+	size_t len;
+	char *s;
+
+	js = JSValueToStringCopy(webkit_javascript_result_get_global_context(r),
+			webkit_javascript_result_get_value(r), NULL);
+	len = JSStringGetMaximumUTF8CStringSize(js);
+	s = g_malloc(len);
+	JSStringGetUTF8CString(js, s, len);
+	JSStringRelease(js);
+
+	return s;
+}
+
+static void
+mousetargetchange(WebKitWebView *v, WebKitHitTestResult *r,
+		guint modifiers, Client *c) {
+	const char *uri = NULL;
+
+	c->active = g_get_monotonic_time();
+	if(webkit_hit_test_result_context_is_link(r))
+		uri = webkit_hit_test_result_get_link_uri(r);
+	if(g_strcmp0(uri, c->linkhover)) {
+		g_free(c->linkhover);
+		c->linkhover = g_strdup(uri);
+		updatetitle(c);
+
+		/* only links rested on are worth a lookup */
+		if(c->prefetchtimer) {
+			g_source_remove(c->prefetchtimer);
+			c->prefetchtimer = 0;
+		}
+		if(uri && prefetchdelay) {
+			c->prefetchtimer = g_timeout_add(prefetchdelay,
+					prefetchhover, c);
+		}
+	}
+}
+
+static void
+loadstatuschange(WebKitWebView *v, WebKitLoadEvent e, Client *c) {
+	GTlsCertificateFlags errors;
+	char *uri, *script, *host, *hover;
+
+	switch(e) {
+	case WEBKIT_LOAD_REDIRECTED:
+		/* once per load, a site redirecting back would loop forever */
+		if(!c->norewrite && rewriteview(c, geturi(c)))
+			break;
+		sitesettings(c);
+		break;
+	case WEBKIT_LOAD_STARTED:
+		c->batchloading = c->batchuri != NULL;
+		/* rewritten already by loaduri() or rewriteview(), or a POST */
+		c->norewrite = c->rewritten || (c->posturi &&
+				!strcmp(c->posturi, geturi(c)));
+		g_free(c->posturi);
+		c->posturi = NULL;
+		if(c->norewrite) {
+			c->rewritten = FALSE;
+		} else if(rewriteview(c, geturi(c))) {
+			break;
+		}
+		/* before the response, the document is created with them */
+		sitesettings(c);
+		loadsample(c);
+		c->progress = 0;
+		c->resources = 0;
+		c->bytes = 0;
+		c->loadstart = g_get_monotonic_time();
+		c->loadcommit = c->loadpaint = 0;
+		if(c->trace) {
+			g_ptr_array_set_size(c->trace, 0);
+			c->tracestarted = g_get_real_time();
+		}
+		/* only following the link rested on counts */
+		host = gethost(geturi(c));
+		hover = c->linkhover ? gethost(c->linkhover) : NULL;
+		if((c->loadprefetched = host && !g_strcmp0(host, hover) &&
+				g_hash_table_contains(prefetched, host)))
+			prefetchhits++;
+		g_free(hover);
+		g_free(host);
+		g_free(c->title);
+		c->title = g_strdup(geturi(c));
+		c->dirty |= DirtyPage;
 		updatetitle(c);
 		break;
 	case WEBKIT_LOAD_COMMITTED:
+		/* a new page is searched from its start */
+		g_free(c->findtext);
+		c->findtext = NULL;
+		c->loadcommit = g_get_monotonic_time();
+		if(!c->firstcommit) {
+			c->firstcommit = c->loadcommit - c->opened;
+			stamp("first commit");
+		}
+		if(!startupcommit)
+			startupcommit = c->loadcommit - started;
+		if(c->loadprefetched) {
+			commitprefetched += c->loadcommit - c->loadstart;
+			commitsprefetched++;
+		} else if(c->loadstart) {
+			commitother += c->loadcommit - c->loadstart;
+			commitsother++;
+		}
+		sitezoom(c);
 		uri = geturi(c);
 		if(webkit_web_view_get_tls_info(v, NULL, &errors)) {
 			c->sslfailed = errors ? TRUE : FALSE;
 		}
+		c->dirty |= DirtyPage;
+		updatetitle(c);
 		setatom(c, AtomUri, uri);
+		sessionchanged(c);
 		break;
 	case WEBKIT_LOAD_FINISHED:
 		c->progress = 100;
+		c->sessiontoggles = FALSE;
 		updatetitle(c);
+		if(c->trace)
+			writetrace(c, NULL);
+		loadtimes(c);
+		if(c->restorescroll) {
+			c->restorescroll = FALSE;
+			script = g_strdup_printf("window.scrollTo(%ld, %ld)",
+					c->scrollx, c->scrolly);
+			webkit_web_view_run_javascript_in_world(v, script,
+					"surf", NULL, NULL, NULL);
+			g_free(script);
+		}
+		if(batchfile && c->batchloading && !c->batchload) {
+			if(c->batchtimer) {
+				g_source_remove(c->batchtimer);
+				c->batchtimer = 0;
+			}
+			c->batchload = g_get_monotonic_time();
+			c->settle = g_timeout_add(batchsettle, batchsnapshot, c);
+		}
 		break;
 	default:
 		break;
 	}
 }
 
+/* setup() work the first page does not wait for */
+static gboolean
+lateinit(gpointer d) {
+	char *buf, *p;
+
+	lateidle = 0;
+	latedone = TRUE;
+
+	statsfile = buildpath(statsfile);
+	tracedir = buildpath(tracedir);
+	/* not ours, its permissions are left alone */
+	downloaddir = resolvepath(downloaddir);
+	g_mkdir_with_parents(downloaddir, 0755);
+
+	/* reloaded when the files change */
+	scriptmon = monitorfile(scriptfile);
+	stylemon = monitorfile(stylefile);
+
+	/* trimmed in the background, while WebKit uses it */
+	if(cachesize) {
+		cachetrimtimer(NULL);
+		g_timeout_add_seconds(3600, cachetrimtimer, NULL);
+	}
+
+	/* stats are dumped to statsfile on SIGUSR1 and on exit */
+	g_unix_signal_add(SIGUSR1, dumpstats, NULL);
+
+	/* the cgroup v2 of surf, "0::/path" */
+	if(memoryinterval && !batchfile) {
+		if(g_file_get_contents("/proc/self/cgroup", &buf, NULL, NULL)) {
+			if((p = strstr(buf, "0::/"))) {
+				p[strcspn(p, "\n")] = '\0';
+				cgroupdir = g_build_filename("/sys/fs/cgroup",
+						p + 4, NULL);
+			}
+			g_free(buf);
+		}
+		g_timeout_add_seconds(memoryinterval, memorycheck, NULL);
+	}
+
+	/* new windows are opened in this process, not in a batch run */
+	if(singleinstance && !batchfile)
+		listeninstance();
+
+	/*
+	 * Windows are saved every sessionsave seconds, only by a surf holding
+	 * all of them: surfs of one window each would overwrite each other.
+	 */
+	if(sessionsave && instance && !batchfile)
+		g_timeout_add_seconds(sessionsave, savesession, NULL);
+
+	stamp("lateinit");
+	return G_SOURCE_REMOVE;
+}
+
+static void
+listeninstance(void) {
+	GSocketClient *sc;
+	GSocketConnection *conn;
+	GSocketAddress *addr;
+	GError *err = NULL;
+
+	/* a surf started at the same time may be listening already */
+	sc = g_socket_client_new();
+	addr = g_unix_socket_address_new(socketfile);
+	conn = g_socket_client_connect(sc, G_SOCKET_CONNECTABLE(addr), NULL,
+			&err);
+	g_object_unref(sc);
+	if(conn) {
+		g_object_unref(conn);
+		g_object_unref(addr);
+		return;
+	}
+	/* whoever listened here before is gone */
+	if(g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CONNECTION_REFUSED))
+		unlink(socketfile);
+	g_clear_error(&err);
+
+	instance = g_socket_service_new();
+	if(!g_socket_listener_add_address(G_SOCKET_LISTENER(instance), addr,
+				G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+				NULL, NULL, &err)) {
+		fprintf(stderr, "surf: %s: %s\n", socketfile, err->message);
+		g_error_free(err);
+		g_clear_object(&instance);
+	} else {
+		g_signal_connect(G_OBJECT(instance), "incoming",
+				G_CALLBACK(instanceconnect), NULL);
+		g_socket_service_start(instance);
+	}
+	g_object_unref(addr);
+}
+
+/*
+ * One "pattern replacement" per line, as taken by g_regex_replace(). The
+ * patterns are matched at once, the first one matching is applied.
+ */
+static void
+loadrewrites(void) {
+	GString *set;
+	GError *err = NULL;
+	Rewrite r;
+	char *s, *sp, **lines, **l;
+
+	rewrites = g_array_new(FALSE, TRUE, sizeof(Rewrite));
+	if(!g_file_get_contents(rewritefile, &s, NULL, NULL))
+		return;
+	set = g_string_new(NULL);
+	lines = g_strsplit(s, "\n", -1);
+	for(l = lines; *l; l++) {
+		if(**l == '#' || !(sp = strpbrk(*l, " \t")))
+			continue;
+		*sp++ = '\0';
+		if(!(r.re = g_regex_new(*l, G_REGEX_OPTIMIZE, 0, &err))) {
+			fprintf(stderr, "surf: %s: %s\n", rewritefile,
+					err->message);
+			g_clear_error(&err);
+			continue;
+		}
+		r.replacement = g_strdup(g_strstrip(sp));
+		r.hits = 0;
+		/* in the set, group numbers would count the other rules too */
+		r.inset = !numberedrefs(*l);
+		if(r.inset) {
+			g_string_append_printf(set, "%s(?=.*?(?<r%u>%s))",
+					set->len ? "|" : "^(?:", rewrites->len,
+					*l);
+		}
+		g_array_append_val(rewrites, r);
+	}
+	/*
+	 * The alternatives are tried in order at the start, so the first
+	 * rule wins as it would alone. Patterns that do not combine, such
+	 * as ones with their own named groups, are matched one by one.
+	 */
+	if(set->len) {
+		g_string_append_c(set, ')');
+		rewriteset = g_regex_new(set->str, G_REGEX_OPTIMIZE, 0, NULL);
+	}
+	g_string_free(set, TRUE);
+	g_strfreev(lines);
+	g_free(s);
+}
+
+static void
+loadfilters(void) {
+	WebKitUserContentFilterStore *store;
+	struct stat fst, sst;
+
+	if(stat(filterfile, &fst) != 0 || fst.st_size == 0)
+		return;
+
+	/* only recompile when filterfile changed since the last run */
+	store = webkit_user_content_filter_store_new(filterstore);
+	if(stat(filterstore, &sst) == 0 && sst.st_mtime >= fst.st_mtime) {
+		webkit_user_content_filter_store_load(store, "surf", NULL,
+				filterloaded, NULL);
+	} else {
+		compilefilters(store);
+	}
+	g_object_unref(store);
+}
+
+/*
+ * Reopens the windows saved by savesession(). Only the one focused back
+ * then loads, the others are restored like discarded ones.
+ */
+static guint
+loadsession(void) {
+	GVariant *v, *entries, *state;
+	WebKitWebViewSessionState *s;
+	GBytes *b;
+	Client *c;
+	const char *uri, *t;
+	char *data;
+	gsize len, i, n;
+	guint version, focused;
+	gdouble zoom;
+
+	if(!g_file_get_contents(sessionfile, &data, &len, NULL))
+		return 0;
+	v = g_variant_ref_sink(g_variant_new_from_data(
+				G_VARIANT_TYPE("(uua(sdsay))"), data, len,
+				FALSE, g_free, data));
+	g_variant_get(v, "(uu@a(sdsay))", &version, &focused, &entries);
+	n = version == 1 ? g_variant_n_children(entries) : 0;
+
+	for(i = 0; i < n; i++) {
+		g_variant_get_child(entries, i, "(&sd&s@ay)", &uri, &zoom,
+				&t, &state);
+		focusonmap = i == focused;
+		c = newclient(NULL);
+
+		settoggles(c, t);
+		c->sessiontoggles = TRUE;
+		webkit_web_view_set_zoom_level(c->view, zoom);
+
+		b = g_variant_get_data_as_bytes(state);
+		s = webkit_web_view_session_state_new(b);
+		if(focusonmap) {
+			loadstate(c, s, uri);
+			webkit_web_view_session_state_unref(s);
+		} else {
+			c->session = s;
+			c->discarduri = g_strdup(uri);
+			discardview(c);
+			c->title = g_strdup(uri);
+			setatom(c, AtomUri, uri);
+		}
+		updatetitle(c);
+		g_bytes_unref(b);
+		g_variant_unref(state);
+	}
+	focusonmap = TRUE;
+
+	g_variant_unref(entries);
+	g_variant_unref(v);
+
+	return n;
+}
+
+static void
+loadstate(Client *c, WebKitWebViewSessionState *s, const char *uri) {
+	WebKitBackForwardListItem *item;
+
+	webkit_web_view_restore_session_state(c->view, s);
+	item = webkit_back_forward_list_get_current_item(
+			webkit_web_view_get_back_forward_list(c->view));
+	if(item) {
+		webkit_web_view_go_to_back_forward_list_item(c->view, item);
+	} else {
+		webkit_web_view_load_uri(c->view, uri);
+	}
+}
+
+/*
+ * Adds the finished load to the times of its host. Without the first
+ * paint that is done when it arrives, or when the next load starts.
+ */
+static void
+loadtimes(Client *c) {
+	if(!c->loadstart)
+		return;
+	c->loadfinish = g_get_monotonic_time();
+	c->lastcommit = c->loadcommit ? c->loadcommit - c->loadstart : 0;
+	c->lastfinish = c->loadfinish - c->loadstart;
+	g_free(c->loaduri);
+	c->loaduri = g_strdup(geturi(c));
+	if(c->loadpaint)
+		loadsample(c);
+}
+
+static void
+loadsample(Client *c) {
+	HostTimes *t;
+	char *host;
+
+	if(!c->loadstart || !c->loadfinish)
+		return;
+	if(!(host = gethost(c->loaduri))) {
+		c->loadstart = c->loadfinish = 0;
+		return;
+	}
+
+	if(!(t = g_hash_table_lookup(hosttimes, host))) {
+		t = g_new0(HostTimes, 1);
+		t->commit = g_array_new(FALSE, FALSE, sizeof(gdouble));
+		t->paint = g_array_new(FALSE, FALSE, sizeof(gdouble));
+		t->finish = g_array_new(FALSE, FALSE, sizeof(gdouble));
+		g_hash_table_insert(hosttimes, g_strdup(host), t);
+	}
+	t->loads++;
+	sample(t->commit, c->loadstart, c->loadcommit);
+	sample(t->paint, c->loadstart, c->loadpaint);
+	sample(t->finish, c->loadstart, c->loadfinish);
+
+	if(logloads) {
+		fprintf(stderr, "surf: load %s commit %.1f paint %.1f "
+				"finish %.1f ms, %u resources, %s\n", host,
+				c->loadcommit ? (c->loadcommit - c->loadstart)
+				/ 1000.0 : -1.0,
+				c->loadpaint ? (c->loadpaint - c->loadstart)
+				/ 1000.0 : -1.0,
+				(c->loadfinish - c->loadstart) / 1000.0,
+				c->resources, c->loaduri);
+	}
+	c->loadstart = c->loadfinish = 0;
+	g_free(host);
+}
+
+static void
+loaduri(Client *c, const Arg *arg) {
+	char *u = NULL, *rp;
+	const char *uri = (char *)arg->v;
+	Arg a = { .b = FALSE };
+	struct stat st;
+
+	if(strcmp(uri, "") == 0)
+		return;
+
+	/* In case it's a file path. */
+	if(stat(uri, &st) == 0) {
+		rp = realpath(uri, NULL);
+		u = g_strdup_printf("file://%s", rp);
+		free(rp);
+	} else {
+		u = g_strrstr(uri, "://") ? g_strdup(uri)
+			: g_strdup_printf("http://%s", uri);
+	}
+
+	setatom(c, AtomUri, uri);
+	if((rp = rewrite(u))) {
+		g_free(u);
+		u = rp;
+		c->rewritten = TRUE;
+	}
+
+	/* prevents endless loop */
+	if(strcmp(u, geturi(c)) == 0) {
+		reload(c, &a);
+	} else {
+		webkit_web_view_load_uri(c->view, u);
+	}
+	g_free(u);
+}
+
+static void
+loadusercontent(void) {
+	char *source;
+
+	if(userscript) {
+		webkit_user_script_unref(userscript);
+		userscript = NULL;
+	}
+	if(g_file_get_contents(scriptfile, &source, NULL, NULL)) {
+		if(source[0]) {
+			userscript = webkit_user_script_new(
+					source, WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
+					WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_END,
+					NULL, NULL);
+		}
+		g_free(source);
+	}
+
+	if(usersheet) {
+		webkit_user_style_sheet_unref(usersheet);
+		usersheet = NULL;
+	}
+	if(g_file_get_contents(stylefile, &source, NULL, NULL)) {
+		if(source[0]) {
+			usersheet = webkit_user_style_sheet_new(
+					source, WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
+					WEBKIT_USER_STYLE_LEVEL_USER,
+					NULL, NULL);
+		}
+		g_free(source);
+	}
+}
+
+/* one "host toggles" per line, toggles as in the window title */
+static void
+loadsites(void) {
+	char *s, *sp, **lines, **l;
+
+	sites = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	if(!g_file_get_contents(sitefile, &s, NULL, NULL))
+		return;
+	lines = g_strsplit(s, "\n", -1);
+	for(l = lines; *l; l++) {
+		if(!(sp = strchr(*l, ' ')))
+			continue;
+		*sp++ = '\0';
+		g_hash_table_insert(sites, g_strdup(*l), g_strdup(sp));
+	}
+	g_strfreev(lines);
+	g_free(s);
+}
+
+/* one "host level" per line */
+static void
+loadzooms(void) {
+	char *s, *sp, **lines, **l;
+	gdouble *level;
+
+	zooms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	if(!g_file_get_contents(zoomfile, &s, NULL, NULL))
+		return;
+	lines = g_strsplit(s, "\n", -1);
+	for(l = lines; *l; l++) {
+		if(!(sp = strchr(*l, ' ')))
+			continue;
+		*sp++ = '\0';
+		level = g_new(gdouble, 1);
+		*level = g_ascii_strtod(sp, NULL);
+		if(*level > 0) {
+			g_hash_table_insert(zooms, g_strdup(*l), level);
+		} else {
+			g_free(level);
+		}
+	}
+	g_strfreev(lines);
+	g_free(s);
+}
+
+static void
+navigate(Client *c, const Arg *arg) {
+	WebKitBackForwardList *l = webkit_web_view_get_back_forward_list(c->view);
+	int steps = *(int *)arg;
+	WebKitBackForwardListItem *i = webkit_back_forward_list_get_nth_item(l, steps);
+
+	if(WEBKIT_IS_BACK_FORWARD_LIST_ITEM(i))
+		webkit_web_view_go_to_back_forward_list_item(c->view, i);
+}
+
+static Client *
+newclient(Client *rc) {
+	Client *c;
+	GdkGeometry hints = { 1, 1 };
+	GdkWindow *window;
+
+	/* windows opened by a page must share its web process */
+	if(!rc && pool) {
+		c = pool->data;
+		pool = g_list_delete_link(pool, pool);
+		poolhits++;
+	} else {
+		c = prepareclient(rc);
+		if(!rc)
+			poolmisses++;
+	}
+	c->opened = g_get_monotonic_time();
+
+	/* Window */
+	if(batchfile) {
+		c->win = gtk_offscreen_window_new();
+		gtk_widget_set_size_request(c->win, 800, 600);
+	} else if(embed) {
+		c->win = gtk_plug_new(embed);
+	} else {
+		c->win = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+
+		/* TA:  20091214:  Despite what the GNOME docs say, the ICCCM
+		 * is always correct, so we should still call this function.
+		 * But when doing so, we *must* differentiate between a
+		 * WM_CLASS and a resource on the window.  By convention, the
+		 * window class (WM_CLASS) is capped, while the resource is in
+		 * lowercase.   Both these values come as a pair.
+		 */
+		gtk_window_set_wmclass(GTK_WINDOW(c->win), "surf", "Surf");
+
+		/* TA:  20091214:  And set the role here as well -- so that
+		 * sessions can pick this up.
+		 */
+		gtk_window_set_role(GTK_WINDOW(c->win), "Surf");
+
+		/* windows of a restored session wait in the background */
+		gtk_window_set_focus_on_map(GTK_WINDOW(c->win), focusonmap);
+	}
+
+	gtk_widget_realize(GTK_WIDGET(c->win));
+	window = gtk_widget_get_window(GTK_WIDGET(c->win));
+
+	gtk_window_set_default_size(GTK_WINDOW(c->win), 800, 600);
+	g_signal_connect(G_OBJECT(c->win),
+			"destroy",
+			G_CALLBACK(destroywin), c);
+
+	c->mode = startmode;
+	if(!kioskmode && !batchfile)
+		g_signal_connect(G_OBJECT(c->win),
+				"key-press-event",
+				G_CALLBACK(keypress), c);
+
+	/* idle windows give up their page and web process */
+	if(!batchfile) {
+		g_signal_connect(G_OBJECT(c->win),
+				"focus-in-event",
+				G_CALLBACK(windowfocused), c);
+		if(discardunmapped) {
+			g_signal_connect(G_OBJECT(c->win),
+					"unmap-event",
+					G_CALLBACK(windowunmapped), c);
+		}
+		c->active = g_get_monotonic_time();
+		if(discardidle) {
+			c->discardtimer = g_timeout_add_seconds(discardidle,
+					discardcheck, c);
+		}
+	}
+
+	connectview(c);
+	if(tracing)
+		c->trace = g_ptr_array_new_with_free_func(traceunref);
+
+	/* Arranging */
+	gtk_container_add(GTK_CONTAINER(c->win), c->pane);
+	g_object_unref(c->pane);
+
+	/* Setup */
+	gtk_widget_show(c->win);
+	gtk_widget_grab_focus(GTK_WIDGET(c->view));
+	gtk_window_set_geometry_hints(GTK_WINDOW(c->win), NULL, &hints,
+			GDK_HINT_MIN_SIZE);
+	if(!batchfile) {
+		gdk_window_set_events(window, GDK_ALL_EVENTS_MASK);
+		gdk_window_add_filter(window, processx, c);
+	}
+
+	if(runinfullscreen) {
+		c->fullscreen = 0;
+		fullscreen(c, NULL);
+	}
+
+	setatom(c, AtomFind, "");
+	setatom(c, AtomUri, "about:blank");
+
+	c->next = clients;
+	clients = c;
+	sessiondirty = TRUE;
+
+	if(showxid) {
+		gdk_display_sync(gtk_widget_get_display(c->win));
+		printf("%u\n",
+			(guint)GDK_WINDOW_XID(window));
+		fflush(NULL);
+				if (fclose(stdout) != 0) {
+			die("Error closing stdout");
+				}
+		/* stdout is gone, later windows of this instance stay quiet */
+		showxid = FALSE;
+	}
+
+	/* replace the pooled client once the new one got its turn */
+	if(poolsize && !poolfill && !batchfile)
+		poolfill = g_idle_add(fillpool, NULL);
+
+	return c;
+}
+
+static void
+newwindow(Client *c, const Arg *arg, gboolean noembed) {
+	guint i = 0;
+	const char *cmd[17], *uri;
+	const Arg a = { .v = (void *)cmd };
+	char tmp[64];
+
+	if(batchfile)
+		return;
+	if(instance) {
+		openwindow(arg->v ? (char *)arg->v : c->linkhover,
+				noembed ? 0 : embed);
+		return;
+	}
+
+	cmd[i++] = argv0;
+	cmd[i++] = "-a";
+	cmd[i++] = cookiepolicies;
+	if(!enablescrollbars)
+		cmd[i++] = "-b";
+	if(embed && !noembed) {
+		cmd[i++] = "-e";
+		snprintf(tmp, LENGTH(tmp), "%u\n", (int)embed);
+		cmd[i++] = tmp;
+	}
+	if(restoresession)
+		cmd[i++] = "-d";
+	if(!loadimages)
+		cmd[i++] = "-i";
+	if(kioskmode)
+		cmd[i++] = "-k";
+	if(!enableplugins)
+		cmd[i++] = "-p";
+	if(!enablescripts)
+		cmd[i++] = "-s";
+	if(showxid)
+		cmd[i++] = "-x";
+	cmd[i++] = "-c";
+	cmd[i++] = cookiefile;
+	cmd[i++] = "--";
+	uri = arg->v ? (char *)arg->v : c->linkhover;
+	if(uri)
+		cmd[i++] = uri;
+	cmd[i++] = NULL;
+	spawn(NULL, &a);
+}
+
+/*
+ * Whether pattern refers to a group by its number, as \1, \g or (?1) do,
+ * possibly too often as \1 may be octal.
+ */
+static gboolean
+numberedrefs(const char *pattern) {
+	const char *p;
+
+	for(p = pattern; *p; p++) {
+		if(*p == '\\') {
+			if(!*++p)
+				break;
+			if((*p >= '1' && *p <= '9') || *p == 'g')
+				return TRUE;
+		} else if(*p == '(' && p[1] == '?') {
+			if(g_ascii_isdigit(p[2]) || p[2] == 'R' ||
+					((p[2] == '+' || p[2] == '-') &&
+					 g_ascii_isdigit(p[3])))
+				return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static void
+openwindow(const char *uri, Window xid) {
+	Window e = embed;
+	Arg a = { .v = uri };
+	Client *c, *rc = NULL;
+	char *host, *h;
+
+	/* share the web process of a window showing the same host */
+	if(groupbyorigin && (host = gethost(uri))) {
+		for(c = clients; c && !rc; c = c->next) {
+			h = gethost(geturi(c));
+			if(!g_strcmp0(host, h))
+				rc = c;
+			g_free(h);
+		}
+		g_free(host);
+	}
+
+	embed = xid;
+	c = newclient(rc);
+	embed = e;
+
+	if(uri) {
+		loaduri(c, &a);
+	} else {
+		updatetitle(c);
+	}
+}
+
+static gboolean
+contextmenu(WebKitWebView *v, WebKitContextMenu *menu,
+		GdkEvent *e, WebKitHitTestResult *r, Client *c) {
+	GList *items = webkit_context_menu_get_items(menu);
+
+	if(kioskmode)
+		return TRUE;
+
+	for(GList *l = items; l; l = l->next) {
+		if (!webkit_context_menu_item_is_separator(l->data))
+			g_signal_connect(webkit_context_menu_item_get_action(l->data),
+				"activate", G_CALLBACK(menuactivate), c);
+	}
+	if (webkit_hit_test_result_context_is_image(r))
+		c->needle = webkit_hit_test_result_get_image_uri(r);
+
+	return FALSE;
+}
+
 static void
-loaduri(Client *c, const Arg *arg) {
-	char *u = NULL, *rp;
-	const char *uri = (char *)arg->v;
-	Arg a = { .b = FALSE };
-	struct stat st;
-
-	if(strcmp(uri, "") == 0)
-		return;
+menuactivate(GtkAction *gaction, Client *c) {
+	/*
+	 * context-menu-action-2000	open link
+	 * context-menu-action-1	open link in window
+	 * context-menu-action-2	download linked file
+	 * context-menu-action-3	copy link location
+	 * context-menu-action-7	copy image address
+	 * context-menu-action-13	reload
+	 * context-menu-action-10	back
+	 * context-menu-action-11	forward
+	 * context-menu-action-12	stop
+	 */
 
-	/* In case it's a file path. */
-	if(stat(uri, &st) == 0) {
-		rp = realpath(uri, NULL);
-		u = g_strdup_printf("file://%s", rp);
-		free(rp);
-	} else {
-		u = g_strrstr(uri, "://") ? g_strdup(uri)
-			: g_strdup_printf("http://%s", uri);
-	}
+	const char *name, *uri;
 
-	setatom(c, AtomUri, uri);
+	name = gtk_action_get_name(gaction);
+	uri = NULL;
+	if(!g_strcmp0(name, "context-menu-action-3"))
+		uri = c->linkhover;
+	else if(!g_strcmp0(name, "context-menu-action-7"))
+		uri = c->needle;
 
-	/* prevents endless loop */
-	if(strcmp(u, geturi(c)) == 0) {
-		reload(c, &a);
-	} else {
-		webkit_web_view_load_uri(c->view, u);
-	}
-	g_free(u);
+	if(uri)
+		gtk_clipboard_set_text(gtk_clipboard_get(GDK_SELECTION_PRIMARY),
+				uri, -1);
 }
 
 static void
-navigate(Client *c, const Arg *arg) {
-	WebKitBackForwardList *l = webkit_web_view_get_back_forward_list(c->view);
-	int steps = *(int *)arg;
-	WebKitBackForwardListItem *i = webkit_back_forward_list_get_nth_item(l, steps);
-
-	if(WEBKIT_IS_BACK_FORWARD_LIST_ITEM(i))
-		webkit_web_view_go_to_back_forward_list_item(c->view, i);
+pasteuri(GtkClipboard *clipboard, const char *text, gpointer d) {
+	Arg arg = {.v = text };
+	if(text != NULL)
+		loaduri((Client *) d, &arg);
 }
 
 static Client *
-newclient(void) {
+prepareclient(Client *rc) {
 	Client *c;
-	WebKitSettings *settings;
-	WebKitUserContentManager *usercontent;
-	WebKitUserScript *script;
-	WebKitUserStyleSheet *style;
-	GdkGeometry hints = { 1, 1 };
-	GdkScreen *screen;
-	GdkWindow *window;
-	gdouble dpi;
-	char *ua, *source;
 
 	if(!(c = calloc(1, sizeof(Client))))
 		die("Cannot malloc!\n");
 
 	c->title = NULL;
 	c->progress = 100;
-
-	/* Window */
-	if(embed) {
-		c->win = gtk_plug_new(embed);
-	} else {
-		c->win = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-
-		/* TA:  20091214:  Despite what the GNOME docs say, the ICCCM
-		 * is always correct, so we should still call this function.
-		 * But when doing so, we *must* differentiate between a
-		 * WM_CLASS and a resource on the window.  By convention, the
-		 * window class (WM_CLASS) is capped, while the resource is in
-		 * lowercase.   Both these values come as a pair.
-		 */
-		gtk_window_set_wmclass(GTK_WINDOW(c->win), "surf", "Surf");
-
-		/* TA:  20091214:  And set the role here as well -- so that
-		 * sessions can pick this up.
-		 */
-		gtk_window_set_role(GTK_WINDOW(c->win), "Surf");
-	}
-
-	gtk_widget_realize(GTK_WIDGET(c->win));
-	window = gtk_widget_get_window(GTK_WIDGET(c->win));
-
-	gtk_window_set_default_size(GTK_WINDOW(c->win), 800, 600);
-	g_signal_connect(G_OBJECT(c->win),
-			"destroy",
-			G_CALLBACK(destroywin), c);
-
-	if(!kioskmode)
-		addaccelgroup(c);
+	c->dirty = DirtyToggles | DirtyPage;
 
 	/* Pane */
 	c->pane = gtk_paned_new(GTK_ORIENTATION_VERTICAL);
+	g_object_ref_sink(c->pane);
 
 	/* VBox */
 	c->vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
 	gtk_paned_pack1(GTK_PANED(c->pane), c->vbox, TRUE, TRUE);
 
-	/* Webview */
-	usercontent = webkit_user_content_manager_new();
-	c->view = WEBKIT_WEB_VIEW(webkit_web_view_new_with_user_content_manager(usercontent));
-	g_clear_object(&usercontent);
-
-	g_signal_connect(G_OBJECT(c->view),
-			"notify::title", /* good */
-			G_CALLBACK(titlechange), c);
-	g_signal_connect(G_OBJECT(c->view),
-			"mouse-target-changed", /* new */
-			G_CALLBACK(mousetargetchange), c);
-	g_signal_connect(G_OBJECT(c->view),
-			"permission-request", /* new */
-			G_CALLBACK(permisssionrequested), c);
-	g_signal_connect(G_OBJECT(c->view),
-			"create", /* new */
-			G_CALLBACK(createwindow), c);
-	g_signal_connect(G_OBJECT(c->view),
-			"decide-policy", /* new */
-			G_CALLBACK(decidepolicy), c);
-	g_signal_connect(G_OBJECT(c->view),
-			"load-changed", /* new */
-			G_CALLBACK(loadstatuschange), c);
-	g_signal_connect(G_OBJECT(c->view),
-			"notify::estimated-load-progress", /* new */
-			G_CALLBACK(progresschange), c);
-	g_signal_connect(G_OBJECT(c->view),
-			"context-menu", /* new */
-			G_CALLBACK(contextmenu), c);
-	g_signal_connect(G_OBJECT(c->view),
-			"resource-load-started", /* new */
-			G_CALLBACK(beforerequest), c);
-
 	/* Scrolled Window */
 	c->scroll = gtk_scrolled_window_new(NULL, NULL);
 
@@ -666,8 +3001,6 @@ newclient(void) {
 	}
 
 	/* Arranging */
-	gtk_container_add(GTK_CONTAINER(c->scroll), GTK_WIDGET(c->view));
-	gtk_container_add(GTK_CONTAINER(c->win), c->pane);
 	gtk_container_add(GTK_CONTAINER(c->vbox), c->scroll);
 
 	/* Setup */
@@ -676,338 +3009,1049 @@ newclient(void) {
 	gtk_widget_show(c->pane);
 	gtk_widget_show(c->vbox);
 	gtk_widget_show(c->scroll);
+
+	/* stylefile and scriptfile */
+	c->userstyle = true;
+	c->geolocation = allowgeolocation;
+
+	/* Webview */
+	newview(c, rc ? rc->view : NULL, NULL);
+
+	return c;
+}
+
+/*
+ * Builds the view of c. A restored view takes over the settings of the
+ * discarded one, toggles included.
+ */
+static void
+newview(Client *c, WebKitWebView *rv, WebKitSettings *settings) {
+	WebKitUserContentManager *usercontent;
+	gdouble dpi;
+	char *ua;
+
+	/* in surf's own script world, pages can not post to it */
+	usercontent = webkit_user_content_manager_new();
+	webkit_user_content_manager_register_script_message_handler_in_world(
+			usercontent, "surf", "surf");
+	g_signal_connect(G_OBJECT(usercontent),
+			"script-message-received::surf",
+			G_CALLBACK(scriptmessage), c);
+	c->view = WEBKIT_WEB_VIEW(g_object_new(WEBKIT_TYPE_WEB_VIEW,
+				"web-context", context,
+				"user-content-manager", usercontent,
+				"related-view", rv,
+				"settings", settings,
+				NULL));
+	g_clear_object(&usercontent);
+
+	gtk_container_add(GTK_CONTAINER(c->scroll), GTK_WIDGET(c->view));
 	gtk_widget_show(GTK_WIDGET(c->view));
-	gtk_widget_show(c->win);
-	gtk_widget_grab_focus(GTK_WIDGET(c->view));
-	gtk_window_set_geometry_hints(GTK_WINDOW(c->win), NULL, &hints,
-			GDK_HINT_MIN_SIZE);
-	gdk_window_set_events(window, GDK_ALL_EVENTS_MASK);
-	gdk_window_add_filter(window, processx, c);
 
-	settings = webkit_web_view_get_settings(c->view);
-	if(!(ua = getenv("SURF_USERAGENT")))
-		ua = useragent;
-	g_object_set(G_OBJECT(settings), "user-agent", ua, NULL); /* good */
-	g_object_set(G_OBJECT(settings), "auto-load-images", loadimages,
-			NULL); /* good */
-	g_object_set(G_OBJECT(settings), "enable-plugins", enableplugins,
-			NULL); /* good */
-	g_object_set(G_OBJECT(settings), "enable-javascript", enablescripts,
-			NULL); /* new */
-	g_object_set(G_OBJECT(settings), "enable-spatial-navigation",
-			enablespatialbrowsing, NULL); /* good */
-	g_object_set(G_OBJECT(settings), "enable-developer-extras",
-			enableinspector, NULL); /* good */
-	g_object_set(G_OBJECT(settings), "default-font-size",
-			defaultfontsize, NULL); /* good */
-	g_object_set(G_OBJECT(settings), "enable-resizable-text-areas",
-			1, NULL); /* new */
-	g_object_set(G_OBJECT(settings), "zoom-text-only",
-			0, NULL); /* new */
+	if(!settings) {
+		settings = webkit_web_view_get_settings(c->view);
+		if(!(ua = getenv("SURF_USERAGENT")))
+			ua = useragent;
+		g_object_set(G_OBJECT(settings), "user-agent", ua,
+				NULL); /* good */
+		g_object_set(G_OBJECT(settings), "auto-load-images",
+				loadimages, NULL); /* good */
+		g_object_set(G_OBJECT(settings), "enable-plugins",
+				enableplugins, NULL); /* good */
+		g_object_set(G_OBJECT(settings), "enable-javascript-markup",
+				enablescripts, NULL); /* new */
+		g_object_set(G_OBJECT(settings), "enable-spatial-navigation",
+				enablespatialbrowsing, NULL); /* good */
+		g_object_set(G_OBJECT(settings), "enable-developer-extras",
+				enableinspector, NULL); /* good */
+		g_object_set(G_OBJECT(settings), "default-font-size",
+				defaultfontsize, NULL); /* good */
+		g_object_set(G_OBJECT(settings), "enable-resizable-text-areas",
+				1, NULL); /* new */
+		g_object_set(G_OBJECT(settings), "zoom-text-only",
+				0, NULL); /* new */
+	}
 
-	/* stylefile and scriptfile */
+	setusercontent(c);
 	usercontent = webkit_web_view_get_user_content_manager(c->view);
-	if(g_file_get_contents(scriptfile, &source, NULL, NULL)) {
-		script = webkit_user_script_new(
-				source, WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
-				WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_END,
-				NULL, NULL);
-		webkit_user_content_manager_add_script(usercontent, script);
-		g_free(source);
-		webkit_user_script_unref(script);
+	if(contentfilter)
+		webkit_user_content_manager_add_filter(usercontent,
+				contentfilter);
+
+	/*
+	 * While stupid, CSS specifies that a pixel represents 1/96 of an inch.
+	 * This ensures websites are not unusably small with a high DPI screen.
+	 * It is equivalent to firefox's "layout.css.devPixelsPerPx" setting.
+	 */
+	if(zoomto96dpi) {
+		dpi = gdk_screen_get_resolution(gdk_screen_get_default());
+		if(dpi != -1) {
+			webkit_web_view_set_zoom_level(c->view, dpi/96);
+		}
+	}
+	/* This might conflict with _zoomto96dpi_. */
+	if(zoomlevel != 1.0)
+		webkit_web_view_set_zoom_level(c->view, zoomlevel);
+	/* what resetting the zoom, or leaving a zoomed host, goes back to */
+	c->defaultzoom = webkit_web_view_get_zoom_level(c->view);
+
+}
+
+/* resolves host once, hosts prefetched already do not count */
+static gboolean
+prefetch(const char *host) {
+	if(g_hash_table_contains(prefetched, host)
+			|| prefetches >= prefetchbudget)
+		return FALSE;
+	prefetches++;
+	g_hash_table_add(prefetched, g_strdup(host));
+	webkit_web_context_prefetch_dns(context, host);
+	return TRUE;
+}
+
+static gboolean
+prefetchhover(gpointer d) {
+	Client *c = (Client *)d;
+	SoupURI *u;
+	GString *s;
+	char *origin;
+
+	c->prefetchtimer = 0;
+	if(!c->view || !c->linkhover || !(u = soup_uri_new(c->linkhover)))
+		return G_SOURCE_REMOVE;
+	if(!u->host || (u->scheme != SOUP_URI_SCHEME_HTTP &&
+				u->scheme != SOUP_URI_SCHEME_HTTPS)) {
+		soup_uri_free(u);
+		return G_SOURCE_REMOVE;
+	}
+
+	if(prefetch(u->host)) {
+		/*
+		 * the page's own network session opens the connection, the
+		 * hint starts it when inserted and is gone before the page
+		 * runs again
+		 */
+		origin = g_strdup_printf("%s://%s:%u", u->scheme, u->host,
+				u->port);
+		s = g_string_new("(function() {"
+				"var p = document.head || document.documentElement;"
+				"if(!p) return;"
+				"var l = document.createElement('link');"
+				"l.rel = 'preconnect'; l.href = ");
+		jsonstr(s, origin);
+		g_string_append(s, "; p.appendChild(l); p.removeChild(l); })()");
+		webkit_web_view_run_javascript_in_world(c->view, s->str,
+				"surf", NULL, NULL, NULL);
+		g_string_free(s, TRUE);
+		g_free(origin);
+	}
+	soup_uri_free(u);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+print(Client *c, const Arg *arg) {
+	WebKitPrintOperation *p = webkit_print_operation_new(c->view);
+	webkit_print_operation_run_dialog(p, GTK_WINDOW(c->win));
+	g_clear_object(&p);
+}
+
+static GdkFilterReturn
+processx(GdkXEvent *e, GdkEvent *event, gpointer d) {
+	Client *c = (Client *)d;
+	XPropertyEvent *ev;
+	Arg arg;
+	int a;
+
+	if(((XEvent *)e)->type == PropertyNotify) {
+		ev = &((XEvent *)e)->xproperty;
+		for(a = 0; a < AtomLast && ev->atom != atoms[a]; a++);
+		if(a == AtomLast || ev->state != PropertyNewValue)
+			return GDK_FILTER_CONTINUE;
+
+		/* written by flushatoms(), the value is known already */
+		if(c->propskip[a] > 0) {
+			c->propskip[a]--;
+			return GDK_FILTER_REMOVE;
+		}
+
+		readatom(c, a);
+		restore(c);
+		if(a == AtomFind) {
+			arg.b = TRUE;
+			find(c, &arg);
+		} else if(a == AtomGo) {
+			arg.v = getatom(c, AtomGo);
+			loaduri(c, &arg);
+		}
+		return GDK_FILTER_REMOVE;
+	}
+	return GDK_FILTER_CONTINUE;
+}
+
+static void
+progresschange(WebKitWebView *v, GParamSpec *pspec, Client *c) {
+	c->progress = webkit_web_view_get_estimated_load_progress(v) * 100;
+	updatetitle(c);
+}
+
+/* while warming up gtk_main() is not running yet, main() quits then */
+static gboolean
+quit(gpointer d) {
+	quitting = TRUE;
+	if(warmuploop)
+		g_main_loop_quit(warmuploop);
+	else
+		gtk_main_quit();
+	return G_SOURCE_REMOVE;
+}
+
+static void
+readatom(Client *c, int a) {
+	Atom type;
+	int format;
+	unsigned long n, after = 0;
+	unsigned char *p = NULL;
+	GString *s;
+	long off = 0, len = 1024;
+
+	/* properties are fetched in 32 bit units, at most two round trips */
+	s = g_string_new(NULL);
+	do {
+		if(XGetWindowProperty(dpy, GDK_WINDOW_XID(gtk_widget_get_window(
+						GTK_WIDGET(c->win))),
+					atoms[a], off, len, False, XA_STRING,
+					&type, &format, &n, &after, &p) != Success)
+			break;
+		if(p) {
+			g_string_append_len(s, (char *)p, n);
+			XFree(p);
+			p = NULL;
+		}
+		off += n / 4;
+		len = (after + 3) / 4;
+	} while(after > 0);
+
+	g_free(c->prop[a]);
+	c->prop[a] = g_string_free(s, FALSE);
+}
+
+static void
+reload(Client *c, const Arg *arg) {
+	gboolean nocache = *(gboolean *)arg;
+	if(nocache) {
+		 webkit_web_view_reload_bypass_cache(c->view);
+	} else {
+		 webkit_web_view_reload(c->view);
+	}
+}
+
+/* on SIGHUP, the reloads are timed like any other load */
+static gboolean
+reloadall(gpointer d) {
+	gboolean nocache = FALSE;
+	Client *c;
+
+	for(c = clients; c; c = c->next) {
+		if(c->view)
+			reload(c, (Arg *)&nocache);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+resourcefinished(WebKitWebResource *r, WebKitWebView *v) {
+	WebKitURIResponse *res;
+	TraceEntry *e;
+	Client *c;
+
+	res = webkit_web_resource_get_response(r);
+	if(res && (c = getclient(v)))
+		c->bytes += webkit_uri_response_get_content_length(res);
+	if((e = g_object_get_data(G_OBJECT(r), "trace"))) {
+		e->end = g_get_monotonic_time();
+		if(!e->size && res)
+			e->size = webkit_uri_response_get_content_length(res);
+	}
+}
+
+static void
+restore(Client *c) {
+	/* a discard in progress is called off */
+	if(c->discarding) {
+		g_cancellable_cancel(c->discarding);
+		g_clear_object(&c->discarding);
+	}
+	if(c->view)
+		return;
+
+	newview(c, NULL, c->settings);
+	g_clear_object(&c->settings);
+	connectview(c);
+	webkit_web_view_set_zoom_level(c->view, c->discardzoom);
+
+	/* the settings of the discarded view hold its toggles */
+	c->sessiontoggles = TRUE;
+	loadstate(c, c->session, c->discarduri);
+	webkit_web_view_session_state_unref(c->session);
+	c->session = NULL;
+	c->restorescroll = TRUE;
+
+	gtk_widget_destroy(c->placeholder);
+	c->placeholder = NULL;
+	if(c->thumb) {
+		cairo_surface_destroy(c->thumb);
+		c->thumb = NULL;
 	}
-	if(g_file_get_contents(stylefile, &source, NULL, NULL)) {
-		style = webkit_user_style_sheet_new(
-				source, WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
-				WEBKIT_USER_STYLE_LEVEL_USER,
-				NULL, NULL);
-		webkit_user_content_manager_add_style_sheet(usercontent, style);
-		g_free(source);
-		webkit_user_style_sheet_unref(style);
+	if(c->discardreport) {
+		g_source_remove(c->discardreport);
+		c->discardreport = 0;
 	}
-	c->userstyle = true;
+	g_free(c->discarduri);
+	c->discarduri = NULL;
 
-	/*
-	 * While stupid, CSS specifies that a pixel represents 1/96 of an inch.
-	 * This ensures websites are not unusably small with a high DPI screen.
-	 * It is equivalent to firefox's "layout.css.devPixelsPerPx" setting.
-	 */
-	if(zoomto96dpi) {
-		screen = gdk_window_get_screen(window);
-		dpi = gdk_screen_get_resolution(screen);
-		if(dpi != -1) {
-			webkit_web_view_set_zoom_level(c->view, dpi/96);
-		}
+	gtk_widget_show(c->scroll);
+	gtk_widget_grab_focus(GTK_WIDGET(c->view));
+	c->active = g_get_monotonic_time();
+	if(discardidle && !c->discardtimer) {
+		c->discardtimer = g_timeout_add_seconds(discardidle,
+				discardcheck, c);
 	}
-	/* This might conflict with _zoomto96dpi_. */
-	if(zoomlevel != 1.0)
-		webkit_web_view_set_zoom_level(c->view, zoomlevel);
+}
 
-	if(enableinspector) {
-		c->inspector = webkit_web_view_get_inspector(c->view);
-		g_signal_connect(G_OBJECT(c->inspector), "attach",
-				G_CALLBACK(inspector_show), c);
-		g_signal_connect(G_OBJECT(c->inspector), "closed",
-				G_CALLBACK(inspector_close), c);
-		c->isinspecting = false;
+/*
+ * Messages posted by perfsource to window.webkit.messageHandlers.surf,
+ * which only exists in the "surf" world
+ */
+static void
+scriptmessage(WebKitUserContentManager *m, WebKitJavascriptResult *r,
+		Client *c) {
+	guint hits, misses;
+	int pid;
+	char *s;
+
+	s = jsresultstr(r);
+	if(sscanf(s, "cache %u %u", &hits, &misses) == 2) {
+		c->cachehits += hits;
+		c->cachemisses += misses;
+		cachehits += hits;
+		cachemisses += misses;
+	} else if(!strcmp(s, "paint") && !c->loadpaint) {
+		c->loadpaint = g_get_monotonic_time();
+		loadsample(c);
+	} else if(sscanf(s, "pid %d", &pid) == 1) {
+		c->webpid = pid;
 	}
+	g_free(s);
+}
 
-	if(runinfullscreen) {
-		c->fullscreen = 0;
-		fullscreen(c, NULL);
+/*
+ * NULL when no rule matches, one regex match for the common case. Rules
+ * left out of the set are matched alone, in their place among the others.
+ */
+static char *
+rewrite(const char *uri) {
+	GMatchInfo *m = NULL;
+	Rewrite *r;
+	char name[16];
+	guint i;
+	gint start;
+	gboolean set;
+
+	set = rewriteset && g_regex_match(rewriteset, uri, 0, &m);
+	for(i = 0; i < rewrites->len; i++) {
+		r = &g_array_index(rewrites, Rewrite, i);
+		if(!r->inset || !rewriteset) {
+			if(g_regex_match(r->re, uri, 0, NULL))
+				break;
+		} else if(set) {
+			snprintf(name, sizeof(name), "r%u", i);
+			if(g_match_info_fetch_named_pos(m, name, &start,
+						NULL) && start != -1)
+				break;
+		}
 	}
+	g_match_info_free(m);
+	if(i == rewrites->len)
+		return NULL;
 
-	setatom(c, AtomFind, "");
-	setatom(c, AtomUri, "about:blank");
+	r->hits++;
+	return g_regex_replace(r->re, uri, -1, 0, r->replacement, 0, NULL);
+}
 
-	c->next = clients;
-	clients = c;
+/* the load of uri is replaced by the one of its rewrite */
+static gboolean
+rewriteview(Client *c, const char *uri) {
+	char *u;
 
-	if(showxid) {
-		gdk_display_sync(gtk_widget_get_display(c->win));
-		printf("%u\n",
-			(guint)GDK_WINDOW_XID(window));
-		fflush(NULL);
-				if (fclose(stdout) != 0) {
-			die("Error closing stdout");
-				}
+	if(!(u = rewrite(uri)))
+		return FALSE;
+	if(!strcmp(u, uri)) {
+		g_free(u);
+		return FALSE;
 	}
+	c->rewritten = TRUE;
+	webkit_web_view_load_uri(c->view, u);
+	g_free(u);
+	return TRUE;
+}
 
-	return c;
+static void
+scroll_h(Client *c, const Arg *arg) {
+	scrollby(c, scrolldelta(gtk_widget_get_allocated_width(
+					GTK_WIDGET(c->view)), arg), 0);
 }
 
 static void
-newwindow(Client *c, const Arg *arg, gboolean noembed) {
-	guint i = 0;
-	const char *cmd[16], *uri;
-	const Arg a = { .v = (void *)cmd };
-	char tmp[64];
+scroll_v(Client *c, const Arg *arg) {
+	scrollby(c, 0, scrolldelta(gtk_widget_get_allocated_height(
+					GTK_WIDGET(c->view)), arg));
+}
 
-	cmd[i++] = argv0;
-	cmd[i++] = "-a";
-	cmd[i++] = cookiepolicies;
-	if(!enablescrollbars)
-		cmd[i++] = "-b";
-	if(embed && !noembed) {
-		cmd[i++] = "-e";
-		snprintf(tmp, LENGTH(tmp), "%u\n", (int)embed);
-		cmd[i++] = tmp;
+/* pixels to scroll a view of the given size */
+static gint
+scrolldelta(gint size, const Arg *arg) {
+	switch(arg->i) {
+	case +10000:
+	case -10000:
+		return MAX(size - (gint)scrollstep, (gint)scrollstep) *
+			(arg->i / 10000);
+	default:
+		return scrollstep * arg->i;
 	}
-	if(!loadimages)
-		cmd[i++] = "-i";
-	if(kioskmode)
-		cmd[i++] = "-k";
-	if(!enableplugins)
-		cmd[i++] = "-p";
-	if(!enablescripts)
-		cmd[i++] = "-s";
-	if(showxid)
-		cmd[i++] = "-x";
-	cmd[i++] = "-c";
-	cmd[i++] = cookiefile;
-	cmd[i++] = "--";
-	uri = arg->v ? (char *)arg->v : c->linkhover;
-	if(uri)
-		cmd[i++] = uri;
-	cmd[i++] = NULL;
-	spawn(NULL, &a);
 }
 
+/* the page scrolls in the web process, one script per frame at most */
 static gboolean
-contextmenu(WebKitWebView *v, WebKitContextMenu *menu,
-		GdkEvent *e, WebKitHitTestResult *r, Client *c) {
-	GList *items = webkit_context_menu_get_items(menu);
+scrollframe(GtkWidget *w, GdkFrameClock *fc, gpointer d) {
+	Client *c = (Client *)d;
+	gint64 now, refresh;
+	gint dx, dy;
+	char *js;
+
+	now = gdk_frame_clock_get_frame_time(fc);
+	gdk_frame_clock_get_refresh_info(fc, now, &refresh, NULL);
+	if(c->scrollframe) {
+		scrollframes++;
+		/* the frame was late by half a refresh */
+		if(now - c->scrollframe > refresh * 3 / 2)
+			scrolljank++;
+	}
+	c->scrollframe = now;
+
+	/* a quarter of the distance left, the rest when it is small */
+	dx = smoothscroll ? c->scrolldx / 4 : 0;
+	dy = smoothscroll ? c->scrolldy / 4 : 0;
+	if(!dx)
+		dx = c->scrolldx;
+	if(!dy)
+		dy = c->scrolldy;
+	c->scrolldx -= dx;
+	c->scrolldy -= dy;
+
+	/* in surf's world, which runs with the scripts of the page off */
+	js = g_strdup_printf("window.scrollBy(%d, %d);", dx, dy);
+	webkit_web_view_run_javascript_in_world(c->view, js, "surf", NULL,
+			NULL, NULL);
+	g_free(js);
+
+	if(c->scrolldx || c->scrolldy)
+		return G_SOURCE_CONTINUE;
+	c->scrolltick = 0;
+	return G_SOURCE_REMOVE;
+}
 
-	if(kioskmode)
-		return TRUE;
+/* repeated keys move the target until the next frame */
+static void
+scrollby(Client *c, gint dx, gint dy) {
+	c->scrolldx += dx;
+	c->scrolldy += dy;
+	if(!c->scrolltick) {
+		c->scrollframe = 0;
+		c->scrolltick = gtk_widget_add_tick_callback(
+				GTK_WIDGET(c->view), scrollframe, c, NULL);
+	}
+}
 
-	for(GList *l = items; l; l = l->next) {
-		if (!webkit_context_menu_item_is_separator(l->data))
-			g_signal_connect(webkit_context_menu_item_get_action(l->data),
-				"activate", G_CALLBACK(menuactivate), c);
+/* the entries of unchanged clients are kept from the last save */
+static gboolean
+savesession(gpointer d) {
+	GVariantBuilder entries;
+	GVariant *v;
+	GBytes *b;
+	GFile *f;
+	GList *l, *order = NULL;
+	Client *c;
+	guint i, focused = 0;
+
+	if(!sessiondirty || sessionwriting || !clients)
+		return G_SOURCE_CONTINUE;
+
+	/* clients is newest first, the session oldest first */
+	for(c = clients; c; c = c->next)
+		order = g_list_prepend(order, c);
+
+	g_variant_builder_init(&entries, G_VARIANT_TYPE("a(sdsay)"));
+	for(l = order, i = 0; l; l = l->next, i++) {
+		c = l->data;
+		g_variant_builder_add_value(&entries, sessionentry(c));
+		if(gtk_window_is_active(GTK_WINDOW(c->win)))
+			focused = i;
 	}
-	if (webkit_hit_test_result_context_is_image(r))
-		c->needle = webkit_hit_test_result_get_image_uri(r);
+	g_list_free(order);
+
+	v = g_variant_ref_sink(g_variant_new("(uua(sdsay))", 1, focused,
+				&entries));
+	b = g_variant_get_data_as_bytes(v);
+	builddir(sessionfile);
+	f = g_file_new_for_path(sessionfile);
+	/* written to a temporary file and renamed in a worker thread */
+	g_file_replace_contents_bytes_async(f, b, NULL, FALSE,
+			G_FILE_CREATE_PRIVATE, NULL, sessionsaved, NULL);
+	sessionwriting = TRUE;
+	sessiondirty = FALSE;
+
+	g_object_unref(f);
+	g_bytes_unref(b);
+	g_variant_unref(v);
+
+	return G_SOURCE_CONTINUE;
+}
 
-	return FALSE;
+/* only -e, -w and -W can be handed over to a running surf */
+static gboolean
+instanceopts(char **argv) {
+	char *o;
+
+	for(argv++; *argv && (*argv)[0] == '-' && (*argv)[1]; argv++) {
+		if(!strcmp(*argv, "--"))
+			break;
+		for(o = *argv + 1; *o; o++) {
+			if(*o == 'e' && !o[1]) {
+				if(!*++argv)
+					return TRUE;
+			} else if(*o != 'w' && *o != 'W') {
+				return FALSE;
+			}
+		}
+	}
+	return TRUE;
 }
 
-static void
-menuactivate(GtkAction *gaction, Client *c) {
-	/*
-	 * context-menu-action-2000	open link
-	 * context-menu-action-1	open link in window
-	 * context-menu-action-2	download linked file
-	 * context-menu-action-3	copy link location
-	 * context-menu-action-7	copy image address
-	 * context-menu-action-13	reload
-	 * context-menu-action-10	back
-	 * context-menu-action-11	forward
-	 * context-menu-action-12	stop
-	 */
+/* ~ is the home directory, relative paths are in the current one */
+static char *
+resolvepath(const char *path) {
+	if(path[0] == '/')
+		return g_strdup(path);
+	if(path[0] == '~') {
+		if(path[1] == '/')
+			return g_strconcat(g_get_home_dir(), &path[1], NULL);
+		return g_strconcat(g_get_home_dir(), "/", &path[1], NULL);
+	}
+	return g_strconcat(g_get_current_dir(), "/", path, NULL);
+}
 
-	const char *name, *uri;
+/* TRUE when a surf listens, and got uri if send is set */
+static gboolean
+sendinstance(const char *uri, gboolean send) {
+	GSocketClient *sc;
+	GSocketConnection *conn;
+	GSocketAddress *addr;
+	char *msg, *rp = NULL;
+	gboolean sent = FALSE;
+	struct stat st;
 
-	name = gtk_action_get_name(gaction);
-	uri = NULL;
-	if(!g_strcmp0(name, "context-menu-action-3"))
-		uri = c->linkhover;
-	else if(!g_strcmp0(name, "context-menu-action-7"))
-		uri = c->needle;
+	sc = g_socket_client_new();
+	addr = g_unix_socket_address_new(socketfile);
+	if((conn = g_socket_client_connect(sc, G_SOCKET_CONNECTABLE(addr),
+					NULL, NULL)) && !send) {
+		sent = TRUE;
+	} else if(conn) {
+		/* the running instance has another working directory */
+		if(uri && stat(uri, &st) == 0 && (rp = realpath(uri, NULL)))
+			uri = rp;
+		msg = g_strdup_printf("%lu %s\n", (unsigned long)embed,
+				uri ? uri : "");
+		sent = g_output_stream_write_all(g_io_stream_get_output_stream(
+					G_IO_STREAM(conn)), msg, strlen(msg),
+				NULL, NULL, NULL);
+		g_free(msg);
+		free(rp);
+	}
+	if(conn)
+		g_object_unref(conn);
+	g_object_unref(addr);
+	g_object_unref(sc);
 
-	if(uri)
-		gtk_clipboard_set_text(gtk_clipboard_get(GDK_SELECTION_PRIMARY),
-				uri, -1);
+	return sent;
 }
 
 static void
-pasteuri(GtkClipboard *clipboard, const char *text, gpointer d) {
-	Arg arg = {.v = text };
-	if(text != NULL)
-		loaduri((Client *) d, &arg);
+setatom(Client *c, int a, const char *v) {
+	char *p = c->prop[a];
+
+	/* offscreen windows have no X window */
+	if(batchfile)
+		return;
+
+	/* v might point into the old value */
+	c->prop[a] = g_strdup(v);
+	g_free(p);
+
+	/* written out in one batch once the main loop is idle */
+	c->propdirty |= 1 << a;
+	if(!c->propidle)
+		c->propidle = g_idle_add(flushatoms, c);
 }
 
 static void
-print(Client *c, const Arg *arg) {
-	WebKitPrintOperation *p = webkit_print_operation_new(c->view);
-	webkit_print_operation_run_dialog(p, GTK_WINDOW(c->win));
-	g_clear_object(&p);
+setmode(Client *c, const Arg *arg) {
+	c->mode = arg->i;
+	updatetitle(c);
 }
 
-static GdkFilterReturn
-processx(GdkXEvent *e, GdkEvent *event, gpointer d) {
-	Client *c = (Client *)d;
-	XPropertyEvent *ev;
-	Arg arg;
+/* the toggle replaces the one of its kind in the rule of the host */
+static void
+setsite(Client *c, char toggle) {
+	GString *s;
+	char *host;
+	const char *t;
 
-	if(((XEvent *)e)->type == PropertyNotify) {
-		ev = &((XEvent *)e)->xproperty;
-		if(ev->state == PropertyNewValue) {
-			if(ev->atom == atoms[AtomFind]) {
-				arg.b = TRUE;
-				find(c, &arg);
+	if(!(host = gethost(geturi(c))))
+		return;
+	s = g_string_new(NULL);
+	if((t = g_hash_table_lookup(sites, host))) {
+		for(; *t; t++) {
+			if(g_ascii_tolower(*t) != g_ascii_tolower(toggle))
+				g_string_append_c(s, *t);
+		}
+	}
+	g_string_append_c(s, toggle);
+	g_hash_table_add(sitechanged, g_strdup(host));
+	g_hash_table_insert(sites, host, g_string_free(s, FALSE));
+	if(!sitesave)
+		sitesave = g_timeout_add_seconds(1, savesites, NULL);
+}
 
-				return GDK_FILTER_REMOVE;
-			} else if(ev->atom == atoms[AtomGo]) {
-				arg.v = getatom(c, AtomGo);
-				loaduri(c, &arg);
+/* t as in the window title, unchanged settings are left alone */
+static void
+settoggles(Client *c, const char *t) {
+	WebKitSettings *settings = webkit_web_view_get_settings(c->view);
 
-				return GDK_FILTER_REMOVE;
+	for(; *t; t++) {
+		switch(g_ascii_tolower(*t)) {
+		case 'c':
+			g_object_set(G_OBJECT(settings),
+					"enable-caret-browsing",
+					*t == 'C', NULL);
+			break;
+		case 'g':
+			c->geolocation = *t == 'G';
+			break;
+		case 'i':
+			g_object_set(G_OBJECT(settings),
+					"auto-load-images",
+					*t == 'I', NULL);
+			break;
+		case 's':
+			g_object_set(G_OBJECT(settings),
+					"enable-javascript-markup",
+					*t == 'S', NULL);
+			break;
+		case 'v':
+			g_object_set(G_OBJECT(settings),
+					"enable-plugins",
+					*t == 'V', NULL);
+			break;
+		case 'm':
+			if(c->userstyle != (*t == 'M')) {
+				c->userstyle = *t == 'M';
+				setusercontent(c);
 			}
+			break;
 		}
 	}
-	return GDK_FILTER_CONTINUE;
+	c->dirty |= DirtyToggles;
 }
 
 static void
-progresschange(WebKitWebView *v, GParamSpec *pspec, Client *c) {
-	c->progress = webkit_web_view_get_estimated_load_progress(v) * 100;
-	updatetitle(c);
+setup(void) {
+	WebKitWebContext *c;
+	WebKitWebsiteDataManager *dm;
+	WebKitCookieManager *cm;
+	GVariantBuilder vb;
+	Rewrite *r;
+	const char *webextdir;
+	guint i;
+
+	/* clean up any zombies immediately */
+	sigchld(0);
+	gtk_init(NULL, NULL);
+	stamp("gtk_init");
+
+	dpy = GDK_DISPLAY_XDISPLAY(gdk_display_get_default());
+
+	/* atoms */
+	atoms[AtomFind] = XInternAtom(dpy, "_SURF_FIND", False);
+	atoms[AtomGo] = XInternAtom(dpy, "_SURF_GO", False);
+	atoms[AtomUri] = XInternAtom(dpy, "_SURF_URI", False);
+
+	/* dirs and files the first page needs, see lateinit() for the rest */
+	cookiefile = buildpath(cookiefile);
+	scriptfile = buildpath(scriptfile);
+	stylefile = buildpath(stylefile);
+	filterfile = buildpath(filterfile);
+	filterstore = g_strconcat(filterfile, ".compiled", NULL);
+	cachedir = buildpath(cachedir);
+	/* only read here, created when written */
+	warmupfile = resolvepath(warmupfile);
+	sessionfile = resolvepath(sessionfile);
+	zoomfile = resolvepath(zoomfile);
+	sitefile = resolvepath(sitefile);
+	rewritefile = resolvepath(rewritefile);
+	stamp("paths");
+
+	/* shared by all clients, empty files are not used */
+	loadusercontent();
+	perfscript = webkit_user_script_new_for_world(perfsource,
+			WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+			WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, "surf",
+			NULL, NULL);
+	stamp("user content");
+
+	/* applied when a page of the host is committed */
+	loadzooms();
+	zoomchanged = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			NULL);
+	/* applied when a page of the host starts loading */
+	loadsites();
+	sitechanged = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			NULL);
+	loadrewrites();
+
+	g_unix_signal_add(SIGINT, quit, NULL);
+	g_unix_signal_add(SIGTERM, quit, NULL);
+	g_unix_signal_add(SIGHUP, reloadall, NULL);
+
+	/* request handler */
+	dm = webkit_website_data_manager_new("disk-cache-directory", cachedir,
+			NULL);
+	context = c = webkit_web_context_new_with_website_data_manager(dm);
+	g_object_unref(dm);
+
+	/* web processes, related views always share one */
+	webkit_web_context_set_process_model(c, processmodel);
+	if(webprocesses)
+		webkit_web_context_set_web_process_count_limit(c, webprocesses);
+
+	/* subresources are rewritten in the web processes, webext-surf.c */
+	if(!(webextdir = getenv("SURF_WEBEXTDIR")))
+		webextdir = WEBEXTDIR;
+	webkit_web_context_set_web_extensions_directory(c, webextdir);
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a(ssb)"));
+	for(i = 0; i < rewrites->len; i++) {
+		r = &g_array_index(rewrites, Rewrite, i);
+		g_variant_builder_add(&vb, "(ssb)", g_regex_get_pattern(r->re),
+				r->replacement, r->inset);
+	}
+	webkit_web_context_set_web_extensions_initialization_user_data(c,
+			g_variant_new("(sa(ssb))", rewriteset ?
+				g_regex_get_pattern(rewriteset) : "", &vb));
+
+	/* caching */
+	webkit_web_context_set_cache_model(c, cachemodel);
+	stamp("context");
+
+	/* downloads */
+	g_signal_connect(G_OBJECT(c), "download-started",
+			G_CALLBACK(downloadstarted), NULL);
+
+	/* cookies */
+	cm = webkit_web_context_get_cookie_manager(c);
+	if(cookiestorage == WEBKIT_COOKIE_PERSISTENT_STORAGE_SQLITE) {
+		/*
+		 * The database is shared safely between processes, it takes
+		 * over the text cookies once, see importcookies().
+		 */
+		cookiedb = buildpath(cookiedb);
+		webkit_cookie_manager_set_persistent_storage(cm,
+				cookiedb, WEBKIT_COOKIE_PERSISTENT_STORAGE_SQLITE);
+		importcookies(cm);
+	} else {
+		webkit_cookie_manager_set_persistent_storage(cm,
+				cookiefile, WEBKIT_COOKIE_PERSISTENT_STORAGE_TEXT);
+	}
+	webkit_cookie_manager_set_accept_policy(cm, cookiepolicy_get());
+	stamp("cookies");
+
+	/* load times, dumped with the stats */
+	hosttimes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			freehosttimes);
+
+	/* hosts we will need soon */
+	prefetched = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			NULL);
+	for(i = 0; hotorigins[i]; i++) {
+		g_hash_table_add(prefetched, g_strdup(hotorigins[i]));
+		webkit_web_context_prefetch_dns(c, hotorigins[i]);
+	}
+
+	/* ssl policy */
+	webkit_web_context_set_tls_errors_policy (c,
+			strictssl ? WEBKIT_TLS_ERRORS_POLICY_FAIL : WEBKIT_TLS_ERRORS_POLICY_IGNORE);
+
+	/* content blocking */
+	loadfilters();
+
+	if(!kioskmode && !batchfile)
+		buildkeymap();
+
+	stamp("setup");
 }
 
 static void
-reload(Client *c, const Arg *arg) {
-	gboolean nocache = *(gboolean *)arg;
-	if(nocache) {
-		 webkit_web_view_reload_bypass_cache(c->view);
+sessionchanged(Client *c) {
+	if(c->sessionentry) {
+		g_variant_unref(c->sessionentry);
+		c->sessionentry = NULL;
+	}
+	sessiondirty = TRUE;
+}
+
+static GVariant *
+sessionentry(Client *c) {
+	WebKitWebViewSessionState *s;
+	GBytes *b;
+
+	if(c->sessionentry)
+		return c->sessionentry;
+
+	if(c->view) {
+		s = webkit_web_view_get_session_state(c->view);
 	} else {
-		 webkit_web_view_reload(c->view);
+		s = webkit_web_view_session_state_ref(c->session);
+	}
+	b = webkit_web_view_session_state_serialize(s);
+	gettogglestat(c);
+	c->sessionentry = g_variant_ref_sink(g_variant_new("(sds@ay)",
+				geturi(c), c->view
+				? webkit_web_view_get_zoom_level(c->view)
+				: c->discardzoom, c->togglestat,
+				g_variant_new_from_bytes(
+					G_VARIANT_TYPE_BYTESTRING, b, TRUE)));
+	g_bytes_unref(b);
+	webkit_web_view_session_state_unref(s);
+
+	return c->sessionentry;
+}
+
+/* written a second after the last toggle */
+static gboolean
+savesites(gpointer d) {
+	GHashTableIter it;
+	GHashTable *own = sites;
+	GString *s;
+	GError *err = NULL;
+	char *host, *toggles;
+
+	sitesave = 0;
+	/* hosts other surfs changed meanwhile are kept, only ours replaced */
+	loadsites();
+	g_hash_table_iter_init(&it, sitechanged);
+	while(g_hash_table_iter_next(&it, (gpointer *)&host, NULL)) {
+		if((toggles = g_hash_table_lookup(own, host))) {
+			g_hash_table_insert(sites, g_strdup(host),
+					g_strdup(toggles));
+		} else {
+			g_hash_table_remove(sites, host);
+		}
+	}
+	g_hash_table_remove_all(sitechanged);
+	g_hash_table_destroy(own);
+
+	s = g_string_new(NULL);
+	g_hash_table_iter_init(&it, sites);
+	while(g_hash_table_iter_next(&it, (gpointer *)&host,
+				(gpointer *)&toggles))
+		g_string_append_printf(s, "%s %s\n", host, toggles);
+	builddir(sitefile);
+	if(!g_file_set_contents(sitefile, s->str, s->len, &err)) {
+		fprintf(stderr, "surf: %s: %s\n", sitefile, err->message);
+		g_error_free(err);
+	} else {
+		g_chmod(sitefile, 0600);
+	}
+	g_string_free(s, TRUE);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* written a second after the last zoom() */
+static gboolean
+savezooms(gpointer d) {
+	GHashTableIter it;
+	GHashTable *own = zooms;
+	GString *s;
+	GError *err = NULL;
+	char *host, buf[G_ASCII_DTOSTR_BUF_SIZE];
+	gdouble *level, *l;
+
+	zoomsave = 0;
+	/* hosts other surfs changed meanwhile are kept, only ours replaced */
+	loadzooms();
+	g_hash_table_iter_init(&it, zoomchanged);
+	while(g_hash_table_iter_next(&it, (gpointer *)&host, NULL)) {
+		if((level = g_hash_table_lookup(own, host))) {
+			l = g_new(gdouble, 1);
+			*l = *level;
+			g_hash_table_insert(zooms, g_strdup(host), l);
+		} else {
+			g_hash_table_remove(zooms, host);
+		}
 	}
+	g_hash_table_remove_all(zoomchanged);
+	g_hash_table_destroy(own);
+
+	s = g_string_new(NULL);
+	g_hash_table_iter_init(&it, zooms);
+	while(g_hash_table_iter_next(&it, (gpointer *)&host,
+				(gpointer *)&level)) {
+		g_string_append_printf(s, "%s %s\n", host,
+				g_ascii_formatd(buf, sizeof(buf), "%.2f",
+					*level));
+	}
+	builddir(zoomfile);
+	if(!g_file_set_contents(zoomfile, s->str, s->len, &err)) {
+		fprintf(stderr, "surf: %s: %s\n", zoomfile, err->message);
+		g_error_free(err);
+	} else {
+		g_chmod(zoomfile, 0600);
+	}
+	g_string_free(s, TRUE);
+
+	return G_SOURCE_REMOVE;
 }
 
 static void
-scroll_h(Client *c, const Arg *arg) {
-	scroll(gtk_scrolled_window_get_hadjustment(
-				GTK_SCROLLED_WINDOW(c->scroll)), arg);
+sessionsaved(GObject *o, GAsyncResult *res, gpointer d) {
+	GError *err = NULL;
+
+	sessionwriting = FALSE;
+	if(!g_file_replace_contents_finish(G_FILE(o), res, NULL, &err)) {
+		fprintf(stderr, "surf: %s: %s\n", sessionfile, err->message);
+		g_error_free(err);
+		sessiondirty = TRUE;
+	}
 }
 
+/* events that did not happen are left out */
 static void
-scroll_v(Client *c, const Arg *arg) {
-	scroll(gtk_scrolled_window_get_vadjustment(
-				GTK_SCROLLED_WINDOW(c->scroll)), arg);
+sample(GArray *a, gint64 from, gint64 to) {
+	gdouble ms;
+
+	if(!to)
+		return;
+	if(a->len >= MAX(timingsamples, 1))
+		g_array_remove_index(a, 0);
+	ms = (to - from) / 1000.0;
+	g_array_append_val(a, ms);
 }
 
 static void
-scroll(GtkAdjustment *a, const Arg *arg) {
-	gdouble v;
+setusercontent(Client *c) {
+	WebKitUserContentManager *usercontent;
 
-	v = gtk_adjustment_get_value(a);
-	switch(arg->i) {
-	case +10000:
-	case -10000:
-		v += gtk_adjustment_get_page_increment(a) *
-			(arg->i / 10000);
-		break;
-	case +20000:
-	case -20000:
-	default:
-		v += gtk_adjustment_get_step_increment(a) * arg->i;
-	}
+	/* restore() sets up discarded views */
+	if(!c->view)
+		return;
 
-	v = MAX(v, 0.0);
-	v = MIN(v, gtk_adjustment_get_upper(a) -
-			gtk_adjustment_get_page_size(a));
-	gtk_adjustment_set_value(a, v);
+	usercontent = webkit_web_view_get_user_content_manager(c->view);
+	webkit_user_content_manager_remove_all_scripts(usercontent);
+	webkit_user_content_manager_remove_all_style_sheets(usercontent);
+	webkit_user_content_manager_add_script(usercontent, perfscript);
+	if(userscript)
+		webkit_user_content_manager_add_script(usercontent, userscript);
+	if(usersheet && c->userstyle)
+		webkit_user_content_manager_add_style_sheet(usercontent,
+				usersheet);
 }
 
 static void
-setatom(Client *c, int a, const char *v) {
-	XSync(dpy, False);
-	XChangeProperty(dpy, GDK_WINDOW_XID(gtk_widget_get_window(GTK_WIDGET(c->win))),
-			atoms[a], XA_STRING, 8, PropModeReplace,
-			(unsigned char *)v, strlen(v) + 1);
+sigchld(int unused) {
+	if(signal(SIGCHLD, sigchld) == SIG_ERR)
+		die("Can't install SIGCHLD handler");
+	while(0 < waitpid(-1, NULL, WNOHANG));
 }
 
+/*
+ * The defaults, then the rules of the host and its parent domains, the
+ * most specific last: the rule of example.com applies to www.example.com.
+ * The first load of a restored client keeps the toggles it was saved with.
+ */
 static void
-setup(void) {
-	WebKitWebContext *c;
-	WebKitCookieManager *cm;
-
-	/* clean up any zombies immediately */
-	sigchld(0);
-	gtk_init(NULL, NULL);
-
-	dpy = GDK_DISPLAY_XDISPLAY(gdk_display_get_default());
-
-	/* atoms */
-	atoms[AtomFind] = XInternAtom(dpy, "_SURF_FIND", False);
-	atoms[AtomGo] = XInternAtom(dpy, "_SURF_GO", False);
-	atoms[AtomUri] = XInternAtom(dpy, "_SURF_URI", False);
-
-	/* dirs and files */
-	cookiefile = buildpath(cookiefile);
-	scriptfile = buildpath(scriptfile);
-	stylefile = buildpath(stylefile);
-
-	/* request handler */
-	c = webkit_web_context_get_default();
-
-	/* use browser process model */
-	webkit_web_context_set_process_model(c, WEBKIT_PROCESS_MODEL_MULTIPLE_SECONDARY_PROCESSES);
-
-	/* caching */
-	webkit_web_context_set_cache_model(c, WEBKIT_CACHE_MODEL_WEB_BROWSER);
-
-	/* cookies */
-	cm = webkit_web_context_get_cookie_manager(c);
-	webkit_cookie_manager_set_persistent_storage(cm,
-			cookiefile, WEBKIT_COOKIE_PERSISTENT_STORAGE_TEXT);
-	webkit_cookie_manager_set_accept_policy(cm, cookiepolicy_get());
+sitesettings(Client *c) {
+	GSList *rules = NULL, *l;
+	char *host, *h;
+	const char *t;
+	char defaults[] = {
+		loadimages ? 'I' : 'i', enablescripts ? 'S' : 's',
+		enableplugins ? 'V' : 'v', allowgeolocation ? 'G' : 'g',
+		'M', '\0'
+	};
+
+	if(c->sessiontoggles || !(host = gethost(geturi(c))))
+		return;
+	for(h = host; h; h = (h = strchr(h, '.')) ? h + 1 : NULL) {
+		if((t = g_hash_table_lookup(sites, h)))
+			rules = g_slist_prepend(rules, (gpointer)t);
+	}
+	settoggles(c, defaults);
+	for(l = rules; l; l = l->next)
+		settoggles(c, l->data);
+	g_slist_free(rules);
+	g_free(host);
+	updatetitle(c);
+}
 
-	/* ssl policy */
-	webkit_web_context_set_tls_errors_policy (c,
-			strictssl ? WEBKIT_TLS_ERRORS_POLICY_FAIL : WEBKIT_TLS_ERRORS_POLICY_IGNORE);
+/* set on commit, before the new page is laid out */
+static void
+sitezoom(Client *c) {
+	char *host;
+	gdouble *level = NULL;
+
+	if((host = gethost(geturi(c))))
+		level = g_hash_table_lookup(zooms, host);
+	if(level) {
+		if(webkit_web_view_get_zoom_level(c->view) != *level)
+			webkit_web_view_set_zoom_level(c->view, *level);
+		c->zoomed = TRUE;
+	} else if(c->zoomed) {
+		webkit_web_view_set_zoom_level(c->view, c->defaultzoom);
+		c->zoomed = FALSE;
+	}
+	g_free(host);
 }
 
+/* SURF_TRACE prints when each phase of the startup ended */
 static void
-sigchld(int unused) {
-	if(signal(SIGCHLD, sigchld) == SIG_ERR)
-		die("Can't install SIGCHLD handler");
-	while(0 < waitpid(-1, NULL, WNOHANG));
+stamp(const char *phase) {
+	gint64 now;
+
+	if(!tracestartup)
+		return;
+	now = g_get_monotonic_time();
+	fprintf(stderr, "surf: %9.3f ms (+%8.3f) %s\n",
+			(now - started) / 1000.0, (now - stamped) / 1000.0,
+			phase);
+	stamped = now;
 }
 
 static void
 spawn(Client *c, const Arg *arg) {
+	/* only needed by commands run for a window */
+	if(c)
+		updatewinid(c);
 	if(fork() == 0) {
 		if(dpy)
 			close(ConnectionNumber(dpy));
@@ -1027,12 +4071,23 @@ eval(Client *c, const Arg *arg) {
 
 static void
 stop(Client *c, const Arg *arg) {
+	GList *l, *dl;
+
 	webkit_web_view_stop_loading(c->view);
+
+	/* cancelling removes the download from downloads */
+	dl = g_list_copy(downloads);
+	for(l = dl; l; l = l->next) {
+		if(webkit_download_get_web_view(l->data) == c->view)
+			webkit_download_cancel(l->data);
+	}
+	g_list_free(dl);
 }
 
 static void
 titlechange(WebKitWebView *view, GParamSpec *pspec, Client *c) {
-	c->title = webkit_web_view_get_title(view);
+	g_free(c->title);
+	c->title = g_strdup(webkit_web_view_get_title(view));
 	updatetitle(c);
 }
 
@@ -1046,24 +4101,36 @@ toggle(Client *c, const Arg *arg) {
 	settings = webkit_web_view_get_settings(c->view);
 	g_object_get(G_OBJECT(settings), name, &value, NULL);
 	g_object_set(G_OBJECT(settings), name, !value, NULL);
+	c->dirty |= DirtyToggles;
+	sessionchanged(c);
+
+	/* kept for the host, the next visit loads with it */
+	if(!strcmp(name, "auto-load-images"))
+		setsite(c, value ? 'i' : 'I');
+	else if(!strcmp(name, "enable-javascript-markup"))
+		setsite(c, value ? 's' : 'S');
+	else if(!strcmp(name, "enable-plugins"))
+		setsite(c, value ? 'v' : 'V');
 
 	reload(c, &a);
 }
 
 static void
 togglecookiepolicy(Client *c, const Arg *arg) {
-	WebKitWebContext *context;
 	WebKitCookieManager *cm;
+	Client *p;
 
 	policysel++;
 	if(policysel >= strlen(cookiepolicies))
 		policysel = 0;
 
-	context = webkit_web_context_get_default();
 	cm = webkit_web_context_get_cookie_manager(context);
 	webkit_cookie_manager_set_accept_policy(cm, cookiepolicy_get());
 
-	updatetitle(c);
+	for(p = clients; p; p = p->next) {
+		p->dirty |= DirtyToggles;
+		updatetitle(p);
+	}
 	/* Do not reload. */
 }
 
@@ -1071,7 +4138,10 @@ static void
 togglegeolocation(Client *c, const Arg *arg) {
 	Arg a = { .b = FALSE };
 
-	allowgeolocation ^= 1;
+	c->geolocation ^= 1;
+	c->dirty |= DirtyToggles;
+	updatetitle(c);
+	setsite(c, c->geolocation ? 'G' : 'g');
 
 	reload(c, &a);
 }
@@ -1116,56 +4186,142 @@ togglescrollbars(Client *c, const Arg *arg) {
 
 static void
 togglestyle(Client *c, const Arg *arg) {
-	WebKitUserContentManager *usercontent;
-	WebKitUserStyleSheet *style;
-	char *source;
+	c->userstyle = !c->userstyle;
+	c->dirty |= DirtyToggles;
+	sessionchanged(c);
+	setusercontent(c);
+	updatetitle(c);
+	setsite(c, c->userstyle ? 'M' : 'm');
+}
 
-	usercontent = webkit_web_view_get_user_content_manager(c->view);
-	if(c->userstyle) {
-		webkit_user_content_manager_remove_all_style_sheets(usercontent);
-		c->userstyle = false;
-	} else {
-		if(g_file_get_contents(stylefile, &source, NULL, NULL)) {
-			style = webkit_user_style_sheet_new(
-					source, WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
-					WEBKIT_USER_STYLE_LEVEL_USER,
-					NULL, NULL);
-			webkit_user_content_manager_add_style_sheet(usercontent, style);
-			g_free(source);
-			webkit_user_style_sheet_unref(style);
-		}
-		c->userstyle = true;
+static void
+tracedata(WebKitWebResource *r, guint64 len, gpointer d) {
+	TraceEntry *e = g_object_get_data(G_OBJECT(r), "trace");
+
+	e->size += len;
+}
+
+static void
+tracefailed(WebKitWebResource *r, GError *err, gpointer d) {
+	TraceEntry *e = g_object_get_data(G_OBJECT(r), "trace");
+
+	g_free(e->error);
+	e->error = g_strdup(err->message);
+}
+
+/*
+ * The keyval of the key in group and the modifiers it did not consume:
+ * Ctrl-+ is plus with MODKEY, also when + needs Shift. Shift on letters
+ * stays, bindings are written as Shift and the lower case letter.
+ */
+static guint
+translatekey(GtkWidget *w, GdkEventKey *ev, gint group, guint *mods) {
+	GdkKeymap *km = gdk_keymap_get_for_display(gtk_widget_get_display(w));
+	GdkModifierType consumed;
+	guint key;
+
+	if(!gdk_keymap_translate_keyboard_state(km, ev->hardware_keycode,
+				ev->state, group, &key, NULL, NULL, &consumed)) {
+		key = ev->keyval;
+		consumed = 0;
+	}
+	*mods = CLEANMASK(ev->state & ~consumed);
+	if(gdk_keyval_to_lower(key) != key) {
+		key = gdk_keyval_to_lower(key);
+		*mods |= ev->state & GDK_SHIFT_MASK;
 	}
+	return key;
+}
 
-	updatetitle(c);
+static void
+tracefree(gpointer d) {
+	TraceEntry *e = (TraceEntry *)d;
+
+	g_free(e->uri);
+	g_free(e->method);
+	g_free(e->mime);
+	g_free(e->error);
+}
+
+/*
+ * The entry belongs to both the trace and the resource, so a resource of
+ * a page left already or of a closed window still has it.
+ */
+static void
+traceresource(Client *c, WebKitWebResource *r, WebKitURIRequest *req) {
+	TraceEntry *e;
+
+	e = g_rc_box_new0(TraceEntry);
+	e->uri = g_strdup(webkit_uri_request_get_uri(req));
+	e->method = g_strdup(webkit_uri_request_get_http_method(req));
+	e->started = g_get_real_time();
+	e->start = g_get_monotonic_time();
+	g_ptr_array_add(c->trace, e);
+	g_object_set_data_full(G_OBJECT(r), "trace", g_rc_box_acquire(e),
+			traceunref);
+
+	g_signal_connect(G_OBJECT(r), "sent-request",
+			G_CALLBACK(tracesent), NULL);
+	g_signal_connect(G_OBJECT(r), "notify::response",
+			G_CALLBACK(traceresponse), NULL);
+	g_signal_connect(G_OBJECT(r), "received-data",
+			G_CALLBACK(tracedata), NULL);
+	g_signal_connect(G_OBJECT(r), "failed",
+			G_CALLBACK(tracefailed), NULL);
+}
+
+static void
+traceresponse(WebKitWebResource *r, GParamSpec *pspec, gpointer d) {
+	TraceEntry *e = g_object_get_data(G_OBJECT(r), "trace");
+	WebKitURIResponse *res = webkit_web_resource_get_response(r);
+
+	e->response = g_get_monotonic_time();
+	e->status = webkit_uri_response_get_status_code(res);
+	g_free(e->mime);
+	e->mime = g_strdup(webkit_uri_response_get_mime_type(res));
+}
+
+static void
+tracesent(WebKitWebResource *r, WebKitURIRequest *req,
+		WebKitURIResponse *redirect, gpointer d) {
+	TraceEntry *e = g_object_get_data(G_OBJECT(r), "trace");
+
+	if(!e->sent)
+		e->sent = g_get_monotonic_time();
+}
+
+static void
+traceunref(gpointer d) {
+	g_rc_box_release_full(d, tracefree);
 }
 
 static void
 gettogglestat(Client *c) {
 	gboolean value;
 	int p = 0;
-	WebKitSettings *settings = webkit_web_view_get_settings(c->view);
+	WebKitSettings *settings = c->view ?
+		webkit_web_view_get_settings(c->view) : c->settings;
 
-	togglestat[p++] = cookiepolicy_set(cookiepolicy_get());
+	c->togglestat[p++] = cookiepolicy_set(cookiepolicy_get());
 
 	g_object_get(G_OBJECT(settings), "enable-caret-browsing",
 			&value, NULL);
-	togglestat[p++] = value? 'C': 'c';
+	c->togglestat[p++] = value? 'C': 'c';
 
-	togglestat[p++] = allowgeolocation? 'G': 'g';
+	c->togglestat[p++] = c->geolocation ? 'G': 'g';
 
 	g_object_get(G_OBJECT(settings), "auto-load-images", &value, NULL);
-	togglestat[p++] = value? 'I': 'i';
+	c->togglestat[p++] = value? 'I': 'i';
 
-	g_object_get(G_OBJECT(settings), "enable-javascript", &value, NULL);
-	togglestat[p++] = value? 'S': 's';
+	g_object_get(G_OBJECT(settings), "enable-javascript-markup", &value, NULL);
+	c->togglestat[p++] = value? 'S': 's';
 
 	g_object_get(G_OBJECT(settings), "enable-plugins", &value, NULL);
-	togglestat[p++] = value? 'V': 'v';
+	c->togglestat[p++] = value? 'V': 'v';
 
-	togglestat[p++] = c->userstyle ? 'M': 'm';
+	c->togglestat[p++] = c->userstyle ? 'M': 'm';
 
-	togglestat[p] = '\0';
+	c->togglestat[p] = '\0';
 }
 
 static void
@@ -1173,42 +4329,138 @@ getpagestat(Client *c) {
 	const char *uri = geturi(c);
 
 	if(strstr(uri, "https://") == uri) {
-		pagestat[0] = c->sslfailed ? 'U' : 'T';
+		c->pagestat[0] = c->sslfailed ? 'U' : 'T';
 	} else {
-		pagestat[0] = '-';
+		c->pagestat[0] = '-';
 	}
 
-	pagestat[1] = usingproxy ? 'P' : '-';
-	pagestat[2] = '\0';
+	c->pagestat[1] = usingproxy ? 'P' : '-';
+	c->pagestat[2] = '\0';
 
 }
 
-static void
-updatetitle(Client *c) {
-	char *t;
-
+static gboolean
+settitle(gpointer d) {
+	Client *c = (Client *)d;
+	static gint64 sec = 0;
+	static guint persec = 0;
+	char *t, *dt;
+	gdouble p = 0;
+	GList *l;
+	int n = 0;
+
+	c->titleidle = 0;
 	if(showindicators) {
-		gettogglestat(c);
-		getpagestat(c);
+		if(c->dirty & DirtyToggles)
+			gettogglestat(c);
+		if(c->dirty & DirtyPage)
+			getpagestat(c);
+		c->dirty = 0;
 
 		if(c->linkhover) {
-			t = g_strdup_printf("%s:%s | %s", togglestat,
-					pagestat, c->linkhover);
+			t = g_strdup_printf("%s:%s | %s", c->togglestat,
+					c->pagestat, c->linkhover);
 		} else if(c->progress != 100) {
 			t = g_strdup_printf("[%i%%] %s:%s | %s", c->progress,
-					togglestat, pagestat,
+					c->togglestat, c->pagestat,
 					(c->title == NULL)? "" : c->title);
 		} else {
-			t = g_strdup_printf("%s:%s | %s", togglestat, pagestat,
+			t = g_strdup_printf("%s:%s | %s", c->togglestat,
+					c->pagestat,
 					(c->title == NULL)? "" : c->title);
 		}
+	} else {
+		t = g_strdup((c->title == NULL)? "" : c->title);
+	}
 
-		gtk_window_set_title(GTK_WINDOW(c->win), t);
+	for(l = downloads; l; l = l->next) {
+		if(!c->view || webkit_download_get_web_view(l->data) != c->view)
+			continue;
+		p += webkit_download_get_estimated_progress(l->data);
+		n++;
+	}
+	if(n) {
+		dt = g_strdup_printf("[%d dl %i%%] %s", n, (int)(p / n * 100),
+				t);
 		g_free(t);
-	} else {
-		gtk_window_set_title(GTK_WINDOW(c->win),
-				(c->title == NULL)? "" : c->title);
+		t = dt;
+	}
+
+	/* a count being typed, or the mode if it is not insert */
+	if(c->count || c->mode == ModeNormal) {
+		dt = c->count ? g_strdup_printf("[%u] %s", c->count, t) :
+			g_strdup_printf("[normal] %s", t);
+		g_free(t);
+		t = dt;
+	}
+
+	/*
+	 * findmax matches are counted at most. WebKit starts at the current
+	 * position, the first match found is not known to be the first one:
+	 * matches are numbered from it once the user moved on.
+	 */
+	if(c->findtext && c->findmoved) {
+		dt = g_strdup_printf("[match %u/%u%s] %s", c->findmatch,
+				c->findcount,
+				c->findcount >= findmax ? "+" : "", t);
+		g_free(t);
+		t = dt;
+	} else if(c->findtext) {
+		dt = g_strdup_printf("[%u%s matches] %s", c->findcount,
+				c->findcount >= findmax ? "+" : "", t);
+		g_free(t);
+		t = dt;
+	}
+
+	/* every new title is a round trip to the window manager */
+	if(!g_strcmp0(t, c->wintitle)) {
+		g_free(t);
+		return G_SOURCE_REMOVE;
+	}
+	gtk_window_set_title(GTK_WINDOW(c->win), t);
+	g_free(c->wintitle);
+	c->wintitle = t;
+
+	titleupdates++;
+	if(sec != g_get_monotonic_time() / G_USEC_PER_SEC) {
+		sec = g_get_monotonic_time() / G_USEC_PER_SEC;
+		persec = 0;
+	}
+	titlepeak = MAX(titlepeak, ++persec);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+updatetitle(Client *c) {
+	/* coalesce all changes until the main loop is idle */
+	if(!c->titleidle)
+		c->titleidle = g_idle_add(settitle, c);
+}
+
+static void
+usercontentchanged(GFileMonitor *m, GFile *f, GFile *o, GFileMonitorEvent e,
+		gpointer d) {
+	Client *c;
+	GList *l;
+
+	/* editors saving by renaming a new file over the old one */
+	switch(e) {
+	case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+	case G_FILE_MONITOR_EVENT_DELETED:
+	case G_FILE_MONITOR_EVENT_CREATED:
+	case G_FILE_MONITOR_EVENT_MOVED_IN:
+	case G_FILE_MONITOR_EVENT_RENAMED:
+		break;
+	default:
+		return;
 	}
+
+	loadusercontent();
+	for(c = clients; c; c = c->next)
+		setusercontent(c);
+	for(l = pool; l; l = l->next)
+		setusercontent(l->data);
 }
 
 static void
@@ -1219,15 +4471,310 @@ updatewinid(Client *c) {
 
 static void
 usage(void) {
-	die("usage: %s [-bBfFgGiIkKnNpPsSvx]"
+	die("usage: %s [-bBdDfFgGiIkKmMnNpPsSTvwWx]"
 		" [-a cookiepolicies ] "
-		" [-c cookiefile] [-e xid] [-r scriptfile]"
-		" [-t stylefile] [-u useragent] [-z zoomlevel]"
+		" [-c cookiefile] [-C cachedir] [-e xid] [-j jobs]"
+		" [-l urlfile] [-L cachesize] [-o outdir] [-q processes]"
+		" [-r scriptfile] [-t stylefile] [-u useragent]"
+		" [-y cachemodel] [-z zoomlevel]"
 		" [uri]\n", basename(argv0));
 }
 
+/*
+ * Loads the URIs of warmupfile one after another into a hidden view, so
+ * the first windows find their resources in the cache.
+ */
+static void
+warmup(void) {
+	WebKitWebView *v;
+	GMainLoop *loop;
+	GPtrArray *uris;
+	GSource *timeout;
+	char *data, **lines;
+	gint64 start;
+	int i;
+
+	if(!g_file_get_contents(warmupfile, &data, NULL, NULL))
+		return;
+	lines = g_strsplit(data, "\n", -1);
+	g_free(data);
+	uris = g_ptr_array_new();
+	for(i = 0; lines[i]; i++) {
+		g_strstrip(lines[i]);
+		if(lines[i][0] && lines[i][0] != '#')
+			g_ptr_array_add(uris, lines[i]);
+	}
+	if(!uris->len) {
+		g_ptr_array_free(uris, TRUE);
+		g_strfreev(lines);
+		return;
+	}
+
+	start = g_get_monotonic_time();
+	warmuploop = loop = g_main_loop_new(NULL, FALSE);
+	v = WEBKIT_WEB_VIEW(g_object_ref_sink(g_object_new(WEBKIT_TYPE_WEB_VIEW,
+					"web-context", context, NULL)));
+	g_object_set_data(G_OBJECT(v), "uris", uris);
+	g_signal_connect(G_OBJECT(v), "load-changed",
+			G_CALLBACK(warmupload), loop);
+	g_signal_connect(G_OBJECT(v), "load-failed",
+			G_CALLBACK(warmupfailed), NULL);
+	timeout = g_timeout_source_new_seconds(warmuptimeout);
+	g_source_set_callback(timeout, warmupexpired, loop, NULL);
+	g_source_attach(timeout, NULL);
+
+	warmupload(v, WEBKIT_LOAD_FINISHED, loop);
+	g_main_loop_run(loop);
+	fprintf(stderr, "surf: warmed up %u of %u URIs in %.1f ms\n",
+			GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(v),
+					"loaded")), uris->len,
+			(g_get_monotonic_time() - start) / 1000.0);
+
+	g_source_destroy(timeout);
+	g_source_unref(timeout);
+	webkit_web_view_stop_loading(v);
+	gtk_widget_destroy(GTK_WIDGET(v));
+	g_object_unref(v);
+	g_main_loop_unref(loop);
+	warmuploop = NULL;
+	g_ptr_array_free(uris, TRUE);
+	g_strfreev(lines);
+}
+
+static gboolean
+warmupexpired(gpointer d) {
+	g_main_loop_quit((GMainLoop *)d);
+	return G_SOURCE_REMOVE;
+}
+
+/* a failed load finishes too, it is not counted as loaded */
+static gboolean
+warmupfailed(WebKitWebView *v, WebKitLoadEvent e, char *uri, GError *err,
+		gpointer d) {
+	g_object_set_data(G_OBJECT(v), "failed", GUINT_TO_POINTER(TRUE));
+	return FALSE;
+}
+
+static void
+warmupload(WebKitWebView *v, WebKitLoadEvent e, GMainLoop *loop) {
+	GPtrArray *uris = g_object_get_data(G_OBJECT(v), "uris");
+	guint i = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(v), "next"));
+	guint n = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(v), "loaded"));
+
+	if(e != WEBKIT_LOAD_FINISHED)
+		return;
+	if(i && !g_object_get_data(G_OBJECT(v), "failed"))
+		g_object_set_data(G_OBJECT(v), "loaded",
+				GUINT_TO_POINTER(n + 1));
+	g_object_set_data(G_OBJECT(v), "failed", NULL);
+	if(i >= uris->len) {
+		g_main_loop_quit(loop);
+		return;
+	}
+	g_object_set_data(G_OBJECT(v), "next", GUINT_TO_POINTER(i + 1));
+	webkit_web_view_load_uri(v, uris->pdata[i]);
+}
+
+/* RSS of the process pid, 0 when it is gone */
+static guint64
+procrss(pid_t pid) {
+	char *path, *buf, *p;
+	guint64 rss = 0;
+
+	path = g_strdup_printf("/proc/%d/status", (int)pid);
+	if(g_file_get_contents(path, &buf, NULL, NULL)) {
+		if((p = strstr(buf, "\nVmRSS:\t")))
+			rss = g_ascii_strtoull(p + 8, NULL, 10) * 1024;
+		g_free(buf);
+	}
+	g_free(path);
+
+	return rss;
+}
+
+/* number and summed RSS of the web processes spawned by this surf */
+static guint64
+webprocmem(guint *n) {
+	GDir *d;
+	const char *name;
+	char *path, *buf, *p;
+	guint64 rss = 0;
+
+	*n = 0;
+	if(!(d = g_dir_open("/proc", 0, NULL)))
+		return 0;
+	while((name = g_dir_read_name(d))) {
+		if(!g_ascii_isdigit(*name))
+			continue;
+		path = g_build_filename("/proc", name, "status", NULL);
+		if(g_file_get_contents(path, &buf, NULL, NULL)) {
+			/* the name is truncated to 15 characters */
+			if(strstr(buf, "Name:\tWebKitWebProces")
+					&& (p = strstr(buf, "\nPPid:\t"))
+					&& strtol(p + 7, NULL, 10) == getpid()
+					&& (p = strstr(buf, "\nVmRSS:\t"))) {
+				rss += g_ascii_strtoull(p + 8, NULL, 10) * 1024;
+				(*n)++;
+			}
+			g_free(buf);
+		}
+		g_free(path);
+	}
+	g_dir_close(d);
+
+	return rss;
+}
+
+/*
+ * Also the views sharing a process restarted by memorycheck(), they load
+ * their pages again in a new one.
+ */
+static void
+webprocessterminated(WebKitWebView *v, WebKitWebProcessTerminationReason r,
+		Client *c) {
+	c->webpid = 0;
+	if(r != WEBKIT_WEB_PROCESS_TERMINATED_BY_API) {
+		fprintf(stderr, "surf: web process of %s crashed\n",
+				geturi(c));
+		return;
+	}
+	webkit_web_view_reload(v);
+}
+
+static gboolean
+windowfocused(GtkWidget *w, GdkEvent *e, Client *c) {
+	c->active = g_get_monotonic_time();
+	restore(c);
+	return FALSE;
+}
+
+static gboolean
+windowunmapped(GtkWidget *w, GdkEvent *e, Client *c) {
+	discard(c);
+	return FALSE;
+}
+
+static gint
+slowest(gconstpointer a, gconstpointer b) {
+	const TraceEntry *x = *(TraceEntry **)a, *y = *(TraceEntry **)b;
+	gint64 dx = x->end ? x->end - x->start : 0;
+	gint64 dy = y->end ? y->end - y->start : 0;
+
+	return (dx < dy) - (dx > dy);
+}
+
+static gint
+largest(gconstpointer a, gconstpointer b) {
+	const TraceEntry *x = *(TraceEntry **)a, *y = *(TraceEntry **)b;
+
+	return (x->size < y->size) - (x->size > y->size);
+}
+
+/* HTTP Archive 1.2 of the resources loaded since the last load started */
+static void
+writetrace(Client *c, const Arg *arg) {
+	GString *s;
+	GError *err = NULL;
+	GPtrArray *sorted;
+	TraceEntry *e;
+	char *host, *path;
+	guint i;
+
+	if(!c->trace || !c->trace->len)
+		return;
+
+	s = g_string_new("{ \"log\": {\n\t\"version\": \"1.2\",\n"
+			"\t\"creator\": { \"name\": \"surf\", "
+			"\"version\": \""VERSION"\" },\n"
+			"\t\"pages\": [ { \"startedDateTime\": ");
+	jsontime(s, c->tracestarted);
+	g_string_append(s, ", \"id\": \"page_1\", \"title\": ");
+	jsonstr(s, geturi(c));
+	g_string_append_printf(s, ", \"pageTimings\": { "
+			"\"onContentLoad\": -1, \"onLoad\": %.1f } } ],\n"
+			"\t\"entries\": [",
+			c->loadstart ? (g_get_monotonic_time() - c->loadstart)
+			/ 1000.0 : -1.0);
+
+	for(i = 0; i < c->trace->len; i++) {
+		e = c->trace->pdata[i];
+		g_string_append(s, i ? ",\n\t\t{ \"pageref\": \"page_1\", "
+				"\"startedDateTime\": "
+				: "\n\t\t{ \"pageref\": \"page_1\", "
+				"\"startedDateTime\": ");
+		jsontime(s, e->started);
+		g_string_append_printf(s, ", \"time\": %.1f,\n"
+				"\t\t  \"request\": { \"method\": ",
+				e->end ? (e->end - e->start) / 1000.0 : -1.0);
+		jsonstr(s, e->method ? e->method : "GET");
+		g_string_append(s, ", \"url\": ");
+		jsonstr(s, e->uri);
+		g_string_append_printf(s, ", \"httpVersion\": \"\", "
+				"\"cookies\": [], \"headers\": [], "
+				"\"queryString\": [], \"headersSize\": -1, "
+				"\"bodySize\": -1 },\n"
+				"\t\t  \"response\": { \"status\": %u, "
+				"\"statusText\": ", e->status);
+		jsonstr(s, e->error ? e->error : "");
+		g_string_append(s, ", \"httpVersion\": \"\", "
+				"\"cookies\": [], \"headers\": [], "
+				"\"content\": { \"size\": ");
+		g_string_append_printf(s, "%" G_GUINT64_FORMAT
+				", \"mimeType\": ", e->size);
+		jsonstr(s, e->mime ? e->mime : "");
+		g_string_append_printf(s, " }, \"redirectURL\": \"\", "
+				"\"headersSize\": -1, \"bodySize\": %"
+				G_GUINT64_FORMAT " },\n"
+				"\t\t  \"cache\": {}, \"timings\": { "
+				"\"blocked\": %.1f, \"send\": 0, "
+				"\"wait\": %.1f, \"receive\": %.1f } }",
+				e->size,
+				e->sent ? (e->sent - e->start) / 1000.0 : -1.0,
+				e->sent && e->response
+				? (e->response - e->sent) / 1000.0 : 0.0,
+				e->response && e->end
+				? (e->end - e->response) / 1000.0 : 0.0);
+	}
+	g_string_append(s, "\n\t]\n} }\n");
+
+	host = gethost(geturi(c));
+	path = g_strdup_printf("%s%s-%" G_GINT64_FORMAT ".har", tracedir,
+			host ? host : "page", c->tracestarted / G_USEC_PER_SEC);
+	if(!g_file_set_contents(path, s->str, s->len, &err)) {
+		fprintf(stderr, "surf: %s\n", err->message);
+		g_error_free(err);
+	} else {
+		fprintf(stderr, "surf: %u resources of %s traced to %s\n",
+				c->trace->len, geturi(c), path);
+		sorted = g_ptr_array_sized_new(c->trace->len);
+		for(i = 0; i < c->trace->len; i++)
+			g_ptr_array_add(sorted, c->trace->pdata[i]);
+
+		g_ptr_array_sort(sorted, slowest);
+		for(i = 0; i < MIN(tracetop, sorted->len); i++) {
+			e = sorted->pdata[i];
+			fprintf(stderr, "surf:   slowest %8.1f ms %s\n",
+					e->end ? (e->end - e->start) / 1000.0
+					: -1.0, e->uri);
+		}
+		g_ptr_array_sort(sorted, largest);
+		for(i = 0; i < MIN(tracetop, sorted->len); i++) {
+			e = sorted->pdata[i];
+			fprintf(stderr, "surf:   largest %8" G_GUINT64_FORMAT
+					" B  %s\n", e->size, e->uri);
+		}
+		g_ptr_array_free(sorted, TRUE);
+	}
+	g_free(path);
+	g_free(host);
+	g_string_free(s, TRUE);
+}
+
 static void
 zoom(Client *c, const Arg *arg) {
+	char *host;
+	gdouble *level;
+
 	c->zoomed = TRUE;
 	if(arg->i < 0) {
 		/* zoom out */
@@ -1240,7 +4787,23 @@ zoom(Client *c, const Arg *arg) {
 	} else {
 		/* reset */
 		c->zoomed = FALSE;
-		webkit_web_view_set_zoom_level(c->view, zoomlevel);
+		webkit_web_view_set_zoom_level(c->view, c->defaultzoom);
+	}
+	sessionchanged(c);
+
+	/* remembered for the host */
+	if((host = gethost(geturi(c)))) {
+		g_hash_table_add(zoomchanged, g_strdup(host));
+		if(c->zoomed) {
+			level = g_new(gdouble, 1);
+			*level = webkit_web_view_get_zoom_level(c->view);
+			g_hash_table_insert(zooms, host, level);
+		} else {
+			g_hash_table_remove(zooms, host);
+			g_free(host);
+		}
+		if(!zoomsave)
+			zoomsave = g_timeout_add_seconds(1, savezooms, NULL);
 	}
 }
 
@@ -1248,10 +4811,15 @@ int
 main(int argc, char *argv[]) {
 	Arg arg;
 	Client *c;
+	char *dir;
+	gboolean handover;
 
+	started = stamped = g_get_monotonic_time();
+	tracestartup = getenv("SURF_TRACE") != NULL;
 	memset(&arg, 0, sizeof(arg));
 
 	/* command line args */
+	handover = instanceopts(argv);
 	ARGBEGIN {
 	case 'a':
 		cookiepolicies = EARGF(usage());
@@ -1265,6 +4833,15 @@ main(int argc, char *argv[]) {
 	case 'c':
 		cookiefile = EARGF(usage());
 		break;
+	case 'C':
+		cachedir = EARGF(usage());
+		break;
+	case 'd':
+		restoresession = 0;
+		break;
+	case 'D':
+		restoresession = 1;
+		break;
 	case 'e':
 		embed = strtol(EARGF(usage()), NULL, 0);
 		break;
@@ -1286,24 +4863,45 @@ main(int argc, char *argv[]) {
 	case 'I':
 		loadimages = 1;
 		break;
+	case 'j':
+		batchjobs = strtoul(EARGF(usage()), NULL, 0);
+		break;
 	case 'k':
 		kioskmode = 0;
 		break;
 	case 'K':
 		kioskmode = 1;
 		break;
+	case 'l':
+		batchfile = EARGF(usage());
+		break;
+	case 'L':
+		cachesize = strtoul(EARGF(usage()), NULL, 0);
+		break;
+	case 'm':
+		processmodel = WEBKIT_PROCESS_MODEL_SHARED_SECONDARY_PROCESS;
+		break;
+	case 'M':
+		processmodel = WEBKIT_PROCESS_MODEL_MULTIPLE_SECONDARY_PROCESSES;
+		break;
 	case 'n':
 		enableinspector = 0;
 		break;
 	case 'N':
 		enableinspector = 1;
 		break;
+	case 'o':
+		batchdir = EARGF(usage());
+		break;
 	case 'p':
 		enableplugins = 0;
 		break;
 	case 'P':
 		enableplugins = 1;
 		break;
+	case 'q':
+		webprocesses = strtoul(EARGF(usage()), NULL, 0);
+		break;
 	case 'r':
 		scriptfile = EARGF(usage());
 		break;
@@ -1316,15 +4914,27 @@ main(int argc, char *argv[]) {
 	case 't':
 		stylefile = EARGF(usage());
 		break;
+	case 'T':
+		tracing = 1;
+		break;
 	case 'u':
 		useragent = EARGF(usage());
 		break;
+	case 'w':
+		singleinstance = 0;
+		break;
+	case 'W':
+		singleinstance = 1;
+		break;
 	case 'v':
 		die("surf-"VERSION", ©2009-2014 surf engineers, "
 				"see LICENSE for details\n");
 	case 'x':
 		showxid = TRUE;
 		break;
+	case 'y':
+		cachemodel = cachemodelarg(EARGF(usage()));
+		break;
 	case 'z':
 		zoomlevel = strtof(EARGF(usage()), NULL);
 		break;
@@ -1334,10 +4944,56 @@ main(int argc, char *argv[]) {
 	if(argc > 0)
 		arg.v = argv[0];
 
+	if(batchfile) {
+		setup();
+		lateidle = g_idle_add(lateinit, NULL);
+		if(batch())
+			gtk_main();
+		cleanup();
+		return EXIT_SUCCESS;
+	}
+
+	/*
+	 * Hand the uri over to a running surf. With options it can not
+	 * take, a new surf is started besides it, or becomes the one.
+	 */
+	if(singleinstance) {
+		socketfile = resolvepath(socketfile);
+		dir = g_path_get_dirname(socketfile);
+		g_mkdir_with_parents(dir, 0700);
+		g_free(dir);
+		if(sendinstance(arg.v, handover)) {
+			if(handover)
+				return EXIT_SUCCESS;
+			fprintf(stderr, "surf: options are not handed over to "
+					"a running surf, starting a new one\n");
+			singleinstance = 0;
+		}
+	}
+
 	setup();
-	c = newclient();
+	warmup();
+	stamp("warmup");
+	if(quitting) {
+		cleanup();
+		return EXIT_SUCCESS;
+	}
+	/*
+	 * The rest waits until the first page was requested, added after
+	 * warmup() so its loop does not run it.
+	 */
+	lateidle = g_idle_add(lateinit, NULL);
+	if(restoresession && loadsession() && !arg.v) {
+		gtk_main();
+		cleanup();
+		return EXIT_SUCCESS;
+	}
+
+	c = newclient(NULL);
+	stamp("newclient");
 	if(arg.v) {
 		loaduri(clients, &arg);
+		stamp("loaduri");
 	} else {
 		updatetitle(c);
 	}
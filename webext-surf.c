@@ -0,0 +1,140 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Loaded into every web process of surf, rewrites the requests of the
+ * resources of a page with the rules of rewritefile, see rewrite() in
+ * surf.c for the page itself, and tells surf the process of each page.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <webkit2/webkit-web-extension.h>
+
+typedef struct {
+	GRegex *re;
+	char *replacement;
+	gboolean inset;
+} Rewrite;
+
+static GArray *rewrites;
+static GRegex *rewriteset;
+
+static void pagecreated(WebKitWebExtension *e, WebKitWebPage *p,
+		gpointer unused);
+static char *rewrite(const char *uri);
+static gboolean sendrequest(WebKitWebPage *p, WebKitURIRequest *r,
+		WebKitURIResponse *redirect, gpointer unused);
+static void windowcleared(WebKitScriptWorld *w, WebKitWebPage *p,
+		WebKitFrame *f, gpointer unused);
+
+static void
+pagecreated(WebKitWebExtension *e, WebKitWebPage *p, gpointer unused) {
+	g_signal_connect(G_OBJECT(p), "send-request",
+			G_CALLBACK(sendrequest), NULL);
+}
+
+/* as rewrite() in surf.c, the set matches the rules marked inset at once */
+static char *
+rewrite(const char *uri) {
+	GMatchInfo *m = NULL;
+	Rewrite *r;
+	char name[16];
+	guint i;
+	gint start;
+	gboolean set;
+
+	set = rewriteset && g_regex_match(rewriteset, uri, 0, &m);
+	for(i = 0; i < rewrites->len; i++) {
+		r = &g_array_index(rewrites, Rewrite, i);
+		if(!r->re)
+			continue;
+		if(!r->inset || !rewriteset) {
+			if(g_regex_match(r->re, uri, 0, NULL))
+				break;
+		} else if(set) {
+			snprintf(name, sizeof(name), "r%u", i);
+			if(g_match_info_fetch_named_pos(m, name, &start,
+						NULL) && start != -1)
+				break;
+		}
+	}
+	g_match_info_free(m);
+	if(i == rewrites->len)
+		return NULL;
+
+	return g_regex_replace(r->re, uri, -1, 0, r->replacement, 0, NULL);
+}
+
+static gboolean
+sendrequest(WebKitWebPage *p, WebKitURIRequest *r,
+		WebKitURIResponse *redirect, gpointer unused) {
+	const char *uri = webkit_uri_request_get_uri(r);
+	char *u;
+
+	/*
+	 * The page itself is rewritten by surf before it is requested.
+	 * Redirects are followed as they are, a server redirecting back
+	 * would loop.
+	 */
+	if(redirect || !g_strcmp0(uri, webkit_web_page_get_uri(p)))
+		return FALSE;
+
+	if((u = rewrite(uri))) {
+		webkit_uri_request_set_uri(r, u);
+		g_free(u);
+	}
+	return FALSE;
+}
+
+/* perfsource in surf.c posts surfpid, see memorycheck() there */
+static void
+windowcleared(WebKitScriptWorld *w, WebKitWebPage *p, WebKitFrame *f,
+		gpointer unused) {
+	JSCContext *ctx;
+	JSCValue *v;
+
+	if(!webkit_frame_is_main_frame(f))
+		return;
+	ctx = webkit_frame_get_js_context_for_script_world(f, w);
+	v = jsc_value_new_number(ctx, getpid());
+	jsc_context_set_value(ctx, "surfpid", v);
+	g_object_unref(v);
+	g_object_unref(ctx);
+}
+
+/*
+ * d holds the set of loadrewrites() in surf.c, empty when there is none,
+ * and the rules as "a(ssb)", pattern, replacement and whether it is in
+ * the set. The groups of the set are named after the index of the rule.
+ */
+G_MODULE_EXPORT void
+webkit_web_extension_initialize_with_user_data(WebKitWebExtension *e,
+		const GVariant *d) {
+	GVariantIter *it;
+	Rewrite r;
+	const char *set, *pattern, *replacement;
+
+	/* the world of surf's own scripts, kept for as long as the process */
+	g_signal_connect(G_OBJECT(webkit_script_world_new_with_name("surf")),
+			"window-object-cleared", G_CALLBACK(windowcleared),
+			NULL);
+
+	rewrites = g_array_new(FALSE, FALSE, sizeof(Rewrite));
+	if(!d || !g_variant_is_of_type((GVariant *)d,
+				G_VARIANT_TYPE("(sa(ssb))")))
+		return;
+	g_variant_get((GVariant *)d, "(&sa(ssb))", &set, &it);
+	while(g_variant_iter_next(it, "(&s&sb)", &pattern, &replacement,
+				&r.inset)) {
+		/* kept when it fails, the indices stay those of the set */
+		r.re = g_regex_new(pattern, G_REGEX_OPTIMIZE, 0, NULL);
+		r.replacement = g_strdup(replacement);
+		g_array_append_val(rewrites, r);
+	}
+	g_variant_iter_free(it);
+	if(*set)
+		rewriteset = g_regex_new(set, G_REGEX_OPTIMIZE, 0, NULL);
+	if(rewrites->len)
+		g_signal_connect(G_OBJECT(e), "page-created",
+				G_CALLBACK(pagecreated), NULL);
+}